@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+# runs every script with the jit compiling each word on its first call and
+# again with the jit off, under both engines and with and without --stream,
+# and reports every run whose stdout, stderr or exit code differs
+# usage: bench/differential.sh INTERPRETER [files]
+# without files it runs bench/*.fth and bench/differential/*.fth, so it is run
+# from the root of the repository. the exit code is 1 when any run differs
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 interpreter [files]" >&2
+    exit 2
+fi
+
+forth=$1
+shift
+
+if [ $# -eq 0 ]; then
+    set -- bench/*.fth bench/differential/*.fth
+fi
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+runs=0
+mismatches=0
+
+# runs one configuration into $out/$1.stdout, $out/$1.stderr and $out/$1.code
+run()
+{
+    local name=$1
+    shift
+
+    "$forth" "$@" > "$out/$name.stdout" 2> "$out/$name.stderr"
+    echo $? > "$out/$name.code"
+}
+
+for file in "$@"; do
+    for engine in switch threaded; do
+        for stream in "" --stream; do
+            flags="--engine=$engine $stream"
+
+            run interpreted $flags --jit=off "$file"
+            run jit $flags --jit=threshold=1 "$file"
+
+            runs=$((runs + 1))
+
+            for part in stdout stderr code; do
+                if ! cmp -s "$out/interpreted.$part" "$out/jit.$part"; then
+                    echo "mismatch in $part: $file $flags"
+                    diff "$out/interpreted.$part" "$out/jit.$part" | head -20
+                    mismatches=$((mismatches + 1))
+                fi
+            done
+        done
+    done
+done
+
+echo "$runs runs, $mismatches mismatches"
+
+[ $mismatches -eq 0 ]
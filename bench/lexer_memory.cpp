@@ -0,0 +1,68 @@
+// memory footprint of Lexer::scan on a large generated source
+// build: g++ -std=c++20 -O2 bench/lexer_memory.cpp -o lexer_memory
+// usage: lexer_memory [megabytes]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "../src/lexer.hpp"
+
+std::string generate(size_t bytes)
+{
+    static const char *lines[] =
+    {
+        ": square dup * ;\n",
+        "10 0 do i square . loop nl\n",
+        "\"some string literal\" . nl\n",
+        "( a comment that the lexer skips )\n",
+        "3.25 variable ratio ratio @ 2 * .\n",
+    };
+
+    std::string source;
+
+    source.reserve(bytes + 64);
+
+    for(size_t i = 0; source.size() < bytes; i++)
+        source += lines[i % 5];
+
+    return source;
+}
+
+size_t peak_rss_kb()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#else
+    return 0;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    size_t megabytes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 50;
+
+    std::string source = generate(megabytes * 1024 * 1024);
+
+    size_t before = peak_rss_kb();
+    auto   start  = std::chrono::steady_clock::now();
+
+    auto tokens = Lexer(source).scan();
+
+    auto end = std::chrono::steady_clock::now();
+
+    std::cout
+        << "source:         " << source.size() / (1024 * 1024) << " MB\n"
+        << "tokens:         " << tokens.size() << '\n'
+        << "sizeof(Token):  " << sizeof(Token) << " bytes\n"
+        << "token vector:   " << tokens.capacity() * sizeof(Token) / (1024 * 1024) << " MB reserved\n"
+        << "peak rss:       " << before / 1024 << " MB before scan, " << peak_rss_kb() / 1024 << " MB after\n"
+        << "scan time:      " << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+}
@@ -0,0 +1,124 @@
+// lexer throughput in MB/s on large generated sources of different shapes
+// build: g++ -std=c++20 -O2 bench/lexer_throughput.cpp -o lexer_throughput
+// usage: lexer_throughput [megabytes] [runs] [threads,threads,...]
+// every shape is lexed with each thread count, 1,2,4,8 by default, and the
+// speedup over the first count is printed next to it. more than one thread
+// goes through parallel::lex
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/parallel_lexer.hpp"
+
+std::string generate(size_t bytes, const char **lines, size_t count)
+{
+    std::string source;
+
+    source.reserve(bytes + 256);
+
+    for(size_t i = 0; source.size() < bytes; i++)
+        source += lines[i % count];
+
+    return source;
+}
+
+// best of `runs` so page faults and the first interning pass are not counted
+double megabytes_per_second(const std::string& source, size_t runs, size_t threads, size_t& tokens)
+{
+    double best = 0;
+
+    for(size_t run = 0; run < runs; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        tokens = parallel::lex(source, threads).size();
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        double rate = source.size() / (1024.0 * 1024.0) / elapsed.count();
+
+        best = rate > best ? rate : best;
+    }
+
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    size_t megabytes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 32;
+    size_t runs      = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 5;
+    const char *list = argc > 3 ? argv[3] : "1,2,4,8";
+
+    std::vector<size_t> counts;
+
+    for(char *end; *list; list = *end ? end + 1 : end)
+        counts.push_back(std::max<size_t>(1, std::strtoull(list, &end, 10)));
+
+    static const char *code[] =
+    {
+        ": square dup * ;\n",
+        "10 0 do i square . loop nl\n",
+        "3.25 variable ratio ratio @ 2 * .\n",
+        "begin counter @ 1 + counter ! counter @ 100 >= until\n",
+    };
+
+    static const char *commented[] =
+    {
+        "( a long comment explaining what the next word does and why it is shaped like this )\n",
+        "    : cube ( n -- n ) dup dup * * ;\n",
+    };
+
+    static const char *strings[] =
+    {
+        "\"a fairly long string literal that the lexer has to find the end of\" . nl\n",
+        "\"short\" .\n",
+    };
+
+    static const char *indented[] =
+    {
+        "                                value                                @\n",
+        "\t\t\t\tnext\t\t\t\t\t\t\t\t1\t\t\t\t+!\n",
+    };
+
+    struct Shape
+    {
+        const char  *name;
+        const char **lines;
+        size_t       count;
+    };
+
+    const Shape shapes[] =
+    {
+        {"code",     code,      4},
+        {"comments", commented, 2},
+        {"strings",  strings,   2},
+        {"indented", indented,  2},
+    };
+
+    std::cout << std::thread::hardware_concurrency() << " core(s), string scans use "
+              << (scan::find_either_impl() == scan::scalar::find_either ? "scalar" : "simd") << " kernels\n";
+
+    for(const Shape& shape : shapes)
+    {
+        std::string source = generate(megabytes * 1024 * 1024, shape.lines, shape.count);
+
+        size_t tokens = 0;
+        double first  = 0;
+
+        for(size_t threads : counts)
+        {
+            double rate = megabytes_per_second(source, runs, threads, tokens);
+
+            if(first == 0)
+                first = rate;
+
+            std::cout << shape.name << ":\t" << threads << " thread(s)\t" << rate << " MB/s\t"
+                      << rate / first << "x\t" << tokens << " tokens\n";
+        }
+    }
+}
@@ -0,0 +1,441 @@
+// times every stage of the pipeline on its own, lexing, parsing, compiling and
+// evaluating, over a corpus of programs and two generated sources
+// build: g++ -std=c++20 -O2 bench/pipeline.cpp -o pipeline
+// usage: pipeline [--runs=N] [--generated=MB] [--json=FILE] [--baseline=FILE] [--tolerance=PERCENT]
+//                 [interpreter options] [files]
+// without files it runs the programs in bench/, so it is run from the root of
+// the repository. what the programs print goes to /dev/null, and a program
+// that stops with an error stops the benchmark too.
+// --json writes the results where a later run can read them as --baseline,
+// then any stage whose median got more than --tolerance percent slower is
+// reported and the exit code is 1. bench/baseline.json is the stored
+// baseline, written from the root of the repository by
+//   pipeline --json=bench/baseline.json
+// and it is rewritten the same way after a change that is meant to move the
+// numbers. timings only compare on the machine that wrote the baseline.
+// without files it also times the print loop in bench/print_loop.fth and
+// reports the rate of its output, in MB and lines per second, as the stage
+// output
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+
+#include "../src/lexer.hpp"
+#include "../src/parser.hpp"
+#include "../src/compiler.hpp"
+#include "../src/evaluator.hpp"
+#include "../src/words.hpp"
+#include "../src/options.hpp"
+#include "../src/output.hpp"
+#include "../src/source_file.hpp"
+
+static const char *corpus[] =
+{
+    "bench/fib.fth",
+    "bench/sieve.fth",
+    "bench/nested_loops.fth",
+    "bench/strings.fth",
+    "bench/composite.fth",
+    "bench/call_chain.fth",
+};
+
+// the print heavy program the output rate is measured with
+static const char *print_loop = "bench/print_loop.fth";
+
+static const char *stages[] = {"lex", "parse", "compile", "eval"};
+
+static constexpr size_t STAGES = 4;
+
+// stages faster than this vary too much from run to run to compare
+static constexpr double MIN_COMPARED_NS = 1e6;
+
+struct Benchmark
+{
+    std::string name;
+    std::string source;
+};
+
+struct Result
+{
+    std::string program;
+    const char *stage;
+    size_t      bytes;
+    double      min, median, p99;  // in nanoseconds
+};
+
+// word definitions with locals, each called once from the top level
+std::string generate_words(size_t bytes)
+{
+    std::string source;
+
+    source.reserve(bytes + 256);
+
+    for(size_t i = 0; source.size() < bytes; i++)
+    {
+        std::string n = std::to_string(i);
+
+        source += ": gen" + n + " { a -- x } ( word " + n + " ) a @ 2 * " + n + " + ;\n";
+        source += n + " gen" + n + " drop\n";
+    }
+
+    return source;
+}
+
+// straight line top level code with every kind of literal and a comment
+std::string generate_main(size_t bytes)
+{
+    static const char *lines[] =
+    {
+        "1 2 + 3 * drop\n",
+        "3.25 0.5 * 2 - drop\n",
+        "\"a string literal the lexer has to find the end of\" drop\n",
+        "( a comment that the lexer skips over ) 10 dup * drop\n",
+        "7 constant seven seven @ 1 + drop\n",
+    };
+
+    std::string source;
+
+    source.reserve(bytes + 256);
+
+    for(size_t i = 0; source.size() < bytes; i++)
+        source += lines[i % 5];
+
+    return source;
+}
+
+// the nanoseconds every stage of one program took, `runs` times after a warm up run
+std::vector<Result> measure(const Benchmark& program, const Options& options, size_t runs)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::vector<double> samples[STAGES];
+
+    for(size_t run = 0; run <= runs; run++)
+    {
+        std::vector<Token>       tokens;
+        Program                  compiled;
+        std::optional<Evaluator> evaluator;
+
+        words.clear();
+
+        clock::time_point times[STAGES + 1];
+
+        times[0] = clock::now();
+
+        tokens = Lexer(program.source).scan();
+        times[1] = clock::now();
+
+        Parser(tokens, words).parse();
+        times[2] = clock::now();
+
+        Compiler(compiled, words, options).compile(tokens);
+        times[3] = clock::now();
+
+        evaluator.emplace(compiled, options);
+        evaluator->eval();
+        output.flush();
+        times[4] = clock::now();
+
+        // the first run interns every symbol and warms the caches
+        if(run == 0)
+            continue;
+
+        for(size_t stage = 0; stage < STAGES; stage++)
+            samples[stage].push_back(std::chrono::duration<double, std::nano>(times[stage + 1] - times[stage]).count());
+    }
+
+    std::vector<Result> results;
+
+    for(size_t stage = 0; stage < STAGES; stage++)
+    {
+        std::vector<double>& s = samples[stage];
+
+        std::sort(s.begin(), s.end());
+
+        size_t p99 = std::min(s.size() - 1, (size_t)std::ceil(s.size() * 0.99) - 1);
+
+        results.push_back({program.name, stages[stage], program.source.size(), s.front(), s[s.size() / 2], s[p99]});
+    }
+
+    return results;
+}
+
+struct Printed
+{
+    uint64_t bytes = 0, lines = 0;
+};
+
+// what one run of a program prints, written to a temporary file and counted
+// before output goes back to `null`
+Printed count_output(const Benchmark& program, const Options& options, int null)
+{
+    FILE *file = std::tmpfile();
+
+    if(!file)
+        logger::fatal("cannot create a temporary file");
+
+    output.configure(options.output_buffer, fileno(file));
+
+    {
+        std::vector<Token> tokens = Lexer(program.source).scan();
+        Program            compiled;
+
+        words.clear();
+
+        Parser(tokens, words).parse();
+        Compiler(compiled, words, options).compile(tokens);
+        Evaluator(compiled, options).eval();
+    }
+
+    output.configure(options.output_buffer, null);
+
+    Printed printed;
+    char    chunk[1 << 16];
+
+    std::rewind(file);
+
+    for(size_t read; (read = std::fread(chunk, 1, sizeof(chunk), file)) > 0;)
+    {
+        printed.bytes += read;
+        printed.lines += std::count(chunk, chunk + read, '\n');
+    }
+
+    std::fclose(file);
+
+    return printed;
+}
+
+std::string quoted(const std::string& text)
+{
+    std::string out = "\"";
+
+    for(char c : text)
+    {
+        if(c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+
+    return out + '"';
+}
+
+// one result to a line, so the baseline reader does not need a json parser
+void write_json(const char *path, const std::vector<Result>& results, size_t runs)
+{
+    std::ofstream file(path);
+
+    if(!file)
+        logger::fatal("cannot open '", path, "'");
+
+    file << "{\n  \"runs\": " << runs << ",\n  \"results\": [\n";
+
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+
+        file << "    {\"program\": " << quoted(r.program) << ", \"stage\": \"" << r.stage << "\", \"bytes\": " << r.bytes
+             << ", \"min_ns\": " << (uint64_t)r.min << ", \"median_ns\": " << (uint64_t)r.median << ", \"p99_ns\": " << (uint64_t)r.p99
+             << "}" << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+
+    file << "  ]\n}\n";
+}
+
+// the text of a string field on a line written by write_json
+std::string string_field(const std::string& line, const char *key)
+{
+    size_t at = line.find(std::string("\"") + key + "\": \"");
+
+    if(at == std::string::npos)
+        return {};
+
+    std::string value;
+
+    for(at += std::strlen(key) + 5; at < line.size() && line[at] != '"'; at++)
+    {
+        if(line[at] == '\\')
+            at++;
+        value += line[at];
+    }
+
+    return value;
+}
+
+double number_field(const std::string& line, const char *key)
+{
+    size_t at = line.find(std::string("\"") + key + "\": ");
+
+    return at == std::string::npos ? -1 : std::strtod(line.c_str() + at + std::strlen(key) + 4, nullptr);
+}
+
+// program and stage to the median of a results file
+std::map<std::pair<std::string, std::string>, double> read_baseline(const char *path)
+{
+    std::ifstream file(path);
+
+    if(!file)
+        logger::fatal("cannot open baseline '", path, "'");
+
+    std::map<std::pair<std::string, std::string>, double> medians;
+
+    for(std::string line; std::getline(file, line);)
+    {
+        if(line.find("\"program\"") == std::string::npos)
+            continue;
+
+        medians[{string_field(line, "program"), string_field(line, "stage")}] = number_field(line, "median_ns");
+    }
+
+    return medians;
+}
+
+int main(int argc, char **argv)
+{
+    size_t      runs      = 10;
+    size_t      megabytes = 4;
+    double      tolerance = 10;
+    const char *json      = nullptr;
+    const char *baseline  = nullptr;
+
+    std::vector<char*>       interpreter{argv[0]};
+    std::vector<std::string> files;
+
+    for(int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+
+        if(std::strncmp(arg, "--runs=", 7) == 0)
+            runs = std::max<size_t>(1, option_number(arg + 7, arg));
+        else if(std::strncmp(arg, "--generated=", 12) == 0)
+            megabytes = option_number(arg + 12, arg);
+        else if(std::strncmp(arg, "--tolerance=", 12) == 0)
+            tolerance = option_number(arg + 12, arg);
+        else if(std::strncmp(arg, "--json=", 7) == 0)
+            json = arg + 7;
+        else if(std::strncmp(arg, "--baseline=", 11) == 0)
+            baseline = arg + 11;
+        else if(std::strncmp(arg, "--", 2) == 0)
+            interpreter.push_back(argv[i]);
+        else
+            files.push_back(arg);
+    }
+
+    // the rest is parsed like the options of the interpreter, the file is never opened
+    char placeholder[] = "-";
+
+    interpreter.push_back(placeholder);
+
+    Options options = parse_options(interpreter.size(), interpreter.data());
+
+    int null = open("/dev/null", O_WRONLY);
+
+    if(null < 0)
+        logger::fatal("cannot open /dev/null");
+
+    output.configure(options.output_buffer, null);
+
+    std::map<std::pair<std::string, std::string>, double> base;
+
+    if(baseline)
+        base = read_baseline(baseline);
+
+    std::vector<Benchmark> programs;
+
+    bool whole_corpus = files.empty();
+
+    if(whole_corpus)
+        files.assign(std::begin(corpus), std::end(corpus));
+
+    for(const std::string& path : files)
+    {
+        SourceFile file(path.c_str());
+        programs.push_back({path, std::string(file.view())});
+    }
+
+    if(megabytes)
+    {
+        std::string size = "-" + std::to_string(megabytes) + "mb";
+
+        programs.push_back({"generated-words" + size, generate_words(megabytes * 1024 * 1024)});
+        programs.push_back({"generated-main" + size, generate_main(megabytes * 1024 * 1024)});
+    }
+
+    std::vector<Result> results;
+
+    for(const Benchmark& program : programs)
+    {
+        for(Result& result : measure(program, options, runs))
+            results.push_back(std::move(result));
+    }
+
+    Printed printed;
+
+    // the whole run of the print loop, with the bytes it prints instead of its source
+    if(whole_corpus)
+    {
+        SourceFile file(print_loop);
+        Benchmark  program{print_loop, std::string(file.view())};
+
+        printed = count_output(program, options, null);
+
+        Result result = measure(program, options, runs)[STAGES - 1];
+
+        result.stage = "output";
+        result.bytes = printed.bytes;
+
+        results.push_back(std::move(result));
+    }
+
+    size_t regressions = 0;
+
+    std::printf("%-24s %-8s %12s %12s %12s %9s\n", "program", "stage", "min ms", "median ms", "p99 ms", baseline ? "change" : "");
+
+    for(const Result& r : results)
+    {
+        std::printf("%-24s %-8s %12.3f %12.3f %12.3f", r.program.c_str(), r.stage, r.min / 1e6, r.median / 1e6, r.p99 / 1e6);
+
+        auto it = base.find({r.program, r.stage});
+
+        if(it != base.end() && it->second > 0)
+        {
+            double change = (r.median / it->second - 1) * 100;
+            bool   slower = change > tolerance && std::max(r.median, it->second) >= MIN_COMPARED_NS;
+
+            regressions += slower;
+
+            std::printf(" %+8.1f%%%s", change, slower ? "  regression" : "");
+        }
+
+        std::printf("\n");
+    }
+
+    if(whole_corpus)
+    {
+        double seconds = results.back().median / 1e9;
+
+        std::printf("\noutput of %s: %.1f MB in %llu lines, %.1f MB/s and %.0f lines/s at the median\n", print_loop,
+                    printed.bytes / (1024.0 * 1024.0), (unsigned long long)printed.lines,
+                    printed.bytes / (1024.0 * 1024.0) / seconds, printed.lines / seconds);
+    }
+
+    if(json)
+        write_json(json, results, runs);
+
+    if(regressions)
+    {
+        std::printf("%zu stage(s) more than %g%% slower than the baseline\n", regressions, tolerance);
+        return 1;
+    }
+}
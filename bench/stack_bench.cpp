@@ -0,0 +1,91 @@
+// push/pop throughput of Stack<Value> against the old linked list stack
+// build: g++ -std=c++20 -O2 bench/stack_bench.cpp -o stack_bench
+
+#include <chrono>
+#include <iostream>
+
+#include "../src/types.hpp"
+#include "../src/stack.hpp"
+
+// the node based stack Stack<T> used to be, kept here for comparison
+template<class T>
+class ListStack
+{
+    struct Node
+    {
+        T     data;
+        Node *last;
+    };
+
+public:
+    ~ListStack()
+    {
+        while(tail)
+            pop();
+    }
+
+    void push(T item)
+    {
+        tail = new Node{std::move(item), tail};
+        length++;
+    }
+
+    void pop()
+    {
+        Node *temp = tail;
+        tail = tail->last;
+        delete temp;
+        length--;
+    }
+
+    T& back() { return tail->data; }
+
+    size_t len() const { return length; }
+
+private:
+    Node  *tail   = nullptr;
+    size_t length = 0;
+};
+
+template<class S>
+double run(S& stack, size_t rounds, size_t depth)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    double sink = 0;
+
+    for(size_t r = 0; r < rounds; r++)
+    {
+        for(size_t i = 0; i < depth; i++)
+            stack.push(Value((double)i));
+
+        while(stack.len())
+        {
+            sink += stack.back().as_number();
+            stack.pop();
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+
+    if(sink < 0)
+        std::cout << sink;
+
+    return std::chrono::duration<double>(end - start).count();
+}
+
+int main()
+{
+    const size_t rounds = 100000, depth = 64;
+    const double ops    = (double)rounds * depth * 2;
+
+    ListStack<Value> list;
+    Stack<Value>     contiguous;
+
+    double t_list       = run(list, rounds, depth);
+    double t_contiguous = run(contiguous, rounds, depth);
+
+    std::cout
+        << "linked list: " << ops / t_list / 1e6       << " Mops/s\n"
+        << "contiguous:  " << ops / t_contiguous / 1e6 << " Mops/s\n";
+}
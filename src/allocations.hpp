@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "output.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
+
+// counts the heap traffic of every word and pipeline stage. the global
+// operator new and delete in main.cpp report every block to it, and while it is
+// on each block is kept in a table of its own with the size and whoever
+// allocated it, so a free takes the bytes off the same word and stage.
+// the table is allocated with malloc so it never sees itself, and a lock
+// keeps it whole while the lexer threads allocate
+class AllocationProfiler
+{
+public:
+    // constant initialized, so blocks allocated before main find it ready
+    constexpr AllocationProfiler() = default;
+
+    AllocationProfiler(const AllocationProfiler&) = delete;
+    AllocationProfiler& operator=(const AllocationProfiler&) = delete;
+
+    // reports only when start() was called, and stops counting first
+    ~AllocationProfiler()
+    {
+        report();
+    }
+
+    // blocks allocated before this are not counted, and neither are their frees
+    void start()
+    {
+        tracking.store(true, std::memory_order_relaxed);
+    }
+
+    bool on() const
+    {
+        return tracking.load(std::memory_order_relaxed);
+    }
+
+    void allocated(void *pointer, size_t size)
+    {
+        std::lock_guard lock(mutex);
+
+        if(!on())
+            return;
+
+        Block block{pointer, size, profiler.current(), stats.stage()};
+
+        insert(block);
+
+        add(total, size);
+        add(stages[block.stage], size);
+        add(usage(block.function), size);
+    }
+
+    void freed(void *pointer)
+    {
+        std::lock_guard lock(mutex);
+
+        if(!on())
+            return;
+
+        Block block;
+
+        if(!remove(pointer, block))
+            return;
+
+        total.live                -= block.size;
+        stages[block.stage].live  -= block.size;
+        usage(block.function).live -= block.size;
+    }
+
+private:
+    struct Usage
+    {
+        uint64_t count = 0, bytes = 0;
+        uint64_t live  = 0, peak  = 0;  // bytes allocated and not freed yet
+    };
+
+    // a block that was allocated while tracking and is not freed yet
+    struct Block
+    {
+        void    *pointer;
+        uint64_t size;
+        uint32_t function;  // Profiler::NONE outside of any call
+        uint32_t stage;
+    };
+
+    std::atomic<bool> tracking{false};
+    std::mutex        mutex;
+
+    Usage total;
+    Usage stages[Stats::STAGES + 1];
+    Usage outside;  // nothing was running
+
+    // indexed by profiler function
+    Usage *functions = nullptr;
+    size_t function_count = 0;
+
+    // open addressing with linear probing, a null pointer is an empty slot
+    Block *blocks    = nullptr;
+    size_t capacity  = 0;
+    size_t used      = 0;
+
+    static void add(Usage& usage, size_t size)
+    {
+        usage.count++;
+        usage.bytes += size;
+        usage.live  += size;
+        usage.peak   = std::max(usage.peak, usage.live);
+    }
+
+    Usage& usage(uint32_t function)
+    {
+        if(function == Profiler::NONE)
+            return outside;
+
+        if(function >= function_count)
+        {
+            size_t count = std::max<size_t>(function + 1, function_count * 2);
+
+            functions = (Usage*)std::realloc(functions, count * sizeof(Usage));
+
+            if(!functions)
+                std::abort();
+
+            std::fill(functions + function_count, functions + count, Usage{});
+            function_count = count;
+        }
+
+        return functions[function];
+    }
+
+    size_t slot(void *pointer) const
+    {
+        uint64_t hash = ((uint64_t)(uintptr_t)pointer >> 4) * 0x9E3779B97F4A7C15ull;
+        return (hash ^ (hash >> 32)) & (capacity - 1);
+    }
+
+    void insert(const Block& block)
+    {
+        if((used + 1) * 2 > capacity)
+            grow();
+
+        size_t at = slot(block.pointer);
+
+        while(blocks[at].pointer)
+            at = (at + 1) & (capacity - 1);
+
+        blocks[at] = block;
+        used++;
+    }
+
+    bool remove(void *pointer, Block& block)
+    {
+        if(!capacity)
+            return false;
+
+        size_t at = slot(pointer);
+
+        while(blocks[at].pointer != pointer)
+        {
+            if(!blocks[at].pointer)
+                return false;
+
+            at = (at + 1) & (capacity - 1);
+        }
+
+        block = blocks[at];
+        used--;
+
+        // moves the blocks after it back so probing never stops at a hole
+        for(size_t next = (at + 1) & (capacity - 1); blocks[next].pointer; next = (next + 1) & (capacity - 1))
+        {
+            size_t home = slot(blocks[next].pointer);
+
+            // a block may move to the hole when its home is not between the hole and it
+            if(((next - home) & (capacity - 1)) >= ((next - at) & (capacity - 1)))
+            {
+                blocks[at] = blocks[next];
+                at         = next;
+            }
+        }
+
+        blocks[at].pointer = nullptr;
+        return true;
+    }
+
+    void grow()
+    {
+        Block *old   = blocks;
+        size_t count = capacity;
+
+        capacity = std::max<size_t>(capacity * 2, 1024);
+        blocks   = (Block*)std::calloc(capacity, sizeof(Block));
+        used     = 0;
+
+        if(!blocks)
+            std::abort();
+
+        for(size_t i = 0; i < count; i++)
+        {
+            if(old[i].pointer)
+                insert(old[i]);
+        }
+
+        std::free(old);
+    }
+
+    void report()
+    {
+        {
+            std::lock_guard lock(mutex);
+
+            if(!on())
+                return;
+
+            // what the report itself allocates is left out
+            tracking.store(false, std::memory_order_relaxed);
+        }
+
+        output.flush();
+
+        std::fprintf(stderr, "\nallocations, %llu blocks, %llu bytes, %llu bytes live at the peak, %llu bytes still live\n\n",
+                     (unsigned long long)total.count, (unsigned long long)total.bytes,
+                     (unsigned long long)total.peak, (unsigned long long)total.live);
+
+        auto row = [] (const Usage& usage, std::string_view name)
+        {
+            std::fprintf(stderr, "%12llu %14llu %14llu  %.*s\n", (unsigned long long)usage.count, (unsigned long long)usage.bytes,
+                         (unsigned long long)usage.peak, (int)name.size(), name.data());
+        };
+
+        std::fprintf(stderr, "%12s %14s %14s  %s\n", "blocks", "bytes", "peak live", "stage");
+
+        for(int stage = 0; stage <= Stats::STAGES; stage++)
+        {
+            if(stages[stage].count)
+                row(stages[stage], Stats::name((Stats::Stage)stage));
+        }
+
+        std::vector<uint32_t> order;
+
+        for(uint32_t function = 0; function < function_count; function++)
+        {
+            if(functions[function].count)
+                order.push_back(function);
+        }
+
+        std::sort(order.begin(), order.end(), [&] (uint32_t a, uint32_t b) { return functions[a].bytes > functions[b].bytes; });
+
+        std::fprintf(stderr, "\n%12s %14s %14s  %s\n", "blocks", "bytes", "peak live", "name");
+
+        for(uint32_t function : order)
+            row(functions[function], profiler.name_of(function));
+
+        if(outside.count)
+            row(outside, "(outside of eval)");
+    }
+};
+
+static AllocationProfiler allocations;
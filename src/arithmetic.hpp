@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+
+#include "types.hpp"
+#include "log.hpp"
+#include "bytecode.hpp"
+
+// the binary operators on numbers, shared by the evaluator and the constant
+// folder so both give exactly the same results
+
+// + - and * wrap around, / stays exact and gives a double when it has to
+inline Value int_arithmetic(OpCode op, int64_t a, int64_t b, const Token& token)
+{
+    switch(op)
+    {
+        case OpCode::ADD:           return (int64_t)((uint64_t)a + (uint64_t)b);
+        case OpCode::SUB:           return (int64_t)((uint64_t)a - (uint64_t)b);
+        case OpCode::MUL:           return (int64_t)((uint64_t)a * (uint64_t)b);
+        case OpCode::DIV:
+        {
+            if(b == -1)
+                return (int64_t)(0 - (uint64_t)a);
+            if(b == 0 || a % b != 0)
+                return (double)a / (double)b;
+            return a / b;
+        }
+        case OpCode::EQUAL:         return a == b ? -1 : 0;
+        case OpCode::NOT_EQUAL:     return a != b ? -1 : 0;
+        case OpCode::LESS:          return a < b  ? -1 : 0;
+        case OpCode::GREATER:       return a > b  ? -1 : 0;
+        case OpCode::LESS_EQUAL:    return a <= b ? -1 : 0;
+        case OpCode::GREATER_EQUAL: return a >= b ? -1 : 0;
+        case OpCode::AND:           return a & b;
+        case OpCode::OR:            return a | b;
+        default: logger::runtime_error(token, "invalid operator");
+    }
+    return {};
+}
+
+inline Value real_arithmetic(OpCode op, double a, double b, const Token& token)
+{
+    switch(op)
+    {
+        case OpCode::ADD:           return a + b;
+        case OpCode::SUB:           return a - b;
+        case OpCode::DIV:           return a / b;
+        case OpCode::MUL:           return a * b;
+        case OpCode::EQUAL:         return a == b ? -1 : 0;
+        case OpCode::NOT_EQUAL:     return a != b ? -1 : 0;
+        case OpCode::LESS:          return a < b  ? -1 : 0;
+        case OpCode::GREATER:       return a > b  ? -1 : 0;
+        case OpCode::LESS_EQUAL:    return a <= b ? -1 : 0;
+        case OpCode::GREATER_EQUAL: return a >= b ? -1 : 0;
+        default: logger::runtime_error(token, "invalid operator");
+    }
+    return {};
+}
+
+inline Value arithmetic(OpCode op, const Value& a, const Value& b, const Token& token)
+{
+    if(a.is_int() && b.is_int())
+        return int_arithmetic(op, a.as_int(), b.as_int(), token);
+
+    if(op == OpCode::AND || op == OpCode::OR)
+        return int_arithmetic(op, a.to_int(), b.to_int(), token);
+
+    return real_arithmetic(op, a.as_number(), b.as_number(), token);
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "types.hpp"
+#include "words.hpp"
+
+enum class OpCode : uint8_t
+{
+    PUSH,           // push constants[operand]
+    GLOBAL_REF,     // push a reference to global slot operand
+    LOCAL_REF,      // push a reference to local slot operand, falls back to the global of the same name
+    DEFINE_VAR,     // pop into global slot operand
+    DEFINE_CONST,
+    DEFINE_LOCAL_VAR,   // pop into local slot operand
+    DEFINE_LOCAL_CONST,
+    CALL_BUILTIN,   // call program.builtins[operand]
+    CALL_WORD,      // call program.words[operand]
+    TAIL_CALL,      // call program.words[operand] in place of the word making the call
+    LOOP_INDEX,     // push the index of the innermost do loop
+    TO_R,           // >r, pop onto the return stack
+    R_FROM,         // r>, pop the return stack onto the data stack
+    R_FETCH,        // r@, copy the top of the return stack
+
+    PRINT, FETCH, PRINT_VAR,
+
+    ADD, SUB, MUL, DIV,
+
+    EQUAL, NOT_EQUAL, LESS, GREATER, LESS_EQUAL, GREATER_EQUAL,
+
+    AND, OR, INVERT,
+
+    STORE, ADD_STORE, SUB_STORE, MUL_STORE, DIV_STORE,
+
+    JUMP,           // ip = operand
+    JUMP_IF_FALSE,  // ip = operand when the top of the stack is not truthful, does not pop
+    DO,             // pops end and begin, ip = operand when begin >= end
+    LOOP,           // increments the index, ip = operand while index < end
+
+    // superinstructions the peephole pass fuses pairs of instructions into
+    LITERAL_OP,     // top = top op constants[operand], the op is packed into the operand
+    INCREMENT,      // 1 +
+    DECREMENT,      // 1 -
+    DUP_MUL,        // dup *
+    OVER_OVER,      // over over
+    COMPARE_JUMP,   // a comparison packed into the operand, then jump-if-false
+    FETCH_GLOBAL,   // push the value of global slot operand
+    FETCH_LOCAL,
+    STORE_GLOBAL,   // pop into global slot operand
+    STORE_LOCAL,
+
+    RETURN,
+};
+
+// operands of superinstructions that need an opcode next to their operand
+static constexpr uint32_t PACKED_BITS = 24;
+static constexpr uint32_t PACKED_MASK = (1u << PACKED_BITS) - 1;
+
+inline uint32_t pack(OpCode op, uint32_t operand)
+{
+    return (uint32_t)op << PACKED_BITS | operand;
+}
+
+inline OpCode packed_op(uint32_t operand)
+{
+    return (OpCode)(operand >> PACKED_BITS);
+}
+
+inline bool is_jump(OpCode op)
+{
+    return op == OpCode::JUMP || op == OpCode::JUMP_IF_FALSE || op == OpCode::DO ||
+           op == OpCode::LOOP || op == OpCode::COMPARE_JUMP;
+}
+
+// instructions that index chunk.constants
+inline bool uses_constant(OpCode op)
+{
+    return op == OpCode::PUSH || op == OpCode::LITERAL_OP || op == OpCode::INCREMENT || op == OpCode::DECREMENT;
+}
+
+// instructions that call program.words[operand]
+inline bool is_call(OpCode op)
+{
+    return op == OpCode::CALL_WORD || op == OpCode::TAIL_CALL;
+}
+
+struct Instruction
+{
+    OpCode   op;
+    uint32_t operand;
+
+    // the jump target or constant index, without an opcode packed next to it
+    uint32_t index() const
+    {
+        return op == OpCode::COMPARE_JUMP || op == OpCode::LITERAL_OP ? operand & PACKED_MASK : operand;
+    }
+
+    void set_index(uint32_t index)
+    {
+        operand = op == OpCode::COMPARE_JUMP || op == OpCode::LITERAL_OP ? pack(packed_op(operand), index) : index;
+    }
+};
+
+// an instruction with its opcode replaced by the address of its handler,
+// only built by the threaded engine
+struct ThreadedInstruction
+{
+    const void *handler;
+    uint32_t    operand;
+};
+
+// a compiled word body or top level program
+struct Chunk
+{
+    std::vector<Instruction> code;
+    std::vector<Value>       constants;
+    std::vector<uint32_t>    locals;  // symbol of each local slot
+
+    // built once before execution by the threaded engine
+    std::vector<ThreadedInstruction> threaded;
+
+    // the source token of each instruction, only used for diagnostics
+    std::vector<Token>    tokens;
+    std::vector<uint32_t> token_of;
+
+    const Token& token_at(size_t ip) const
+    {
+        return tokens[token_of[ip]];
+    }
+
+    // superinstructions come from two tokens in a row, errors of their
+    // second half point at the second one
+    const Token& next_token_at(size_t ip) const
+    {
+        return tokens[token_of[ip] + 1];
+    }
+};
+
+struct Program
+{
+    Chunk                    main;
+    std::vector<Chunk>       words;  // indexed by the operand of CALL_WORD
+    std::vector<builtin_fn>  builtins;
+    std::vector<std::string> builtin_names;
+    std::vector<std::string> word_names;
+
+    std::vector<uint32_t>                  globals;       // symbol of each global slot
+    std::unordered_map<uint32_t, uint32_t> global_slots;  // symbol to global slot
+
+    uint32_t global_slot(uint32_t symbol)
+    {
+        auto it = global_slots.find(symbol);
+
+        if(it != global_slots.end())
+            return it->second;
+
+        globals.push_back(symbol);
+        global_slots.emplace(symbol, globals.size()-1);
+
+        return globals.size()-1;
+    }
+};
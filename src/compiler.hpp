@@ -0,0 +1,433 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "types.hpp"
+#include "log.hpp"
+#include "words.hpp"
+#include "symbols.hpp"
+#include "bytecode.hpp"
+#include "options.hpp"
+#include "peephole.hpp"
+#include "fold.hpp"
+#include "inliner.hpp"
+#include "stats.hpp"
+
+// lowers the parsed token stream and every user word into bytecode
+class Compiler
+{
+    using enum TokenType;
+
+    struct Control
+    {
+        TokenType type;
+        size_t    patch;  // instruction whose operand is resolved when the construct closes
+        size_t    start;  // loop start for begin and do
+        uint32_t  token;
+    };
+
+public:
+    Compiler(Program& program, Words& words, const Options& options)
+    : program(program), words(words),
+      peephole(options.peephole), fold_report(options.fold_report),
+      inline_size(options.inline_size), inline_log(options.inline_log)
+    {
+        loop_index_symbol = symbols.intern("i");
+        to_r_symbol       = symbols.intern(">r");
+        r_from_symbol     = symbols.intern("r>");
+        r_fetch_symbol    = symbols.intern("r@");
+
+        // argc and argv always live in the first two global slots
+        program.global_slot(symbols.intern("argc"));
+        program.global_slot(symbols.intern("argv"));
+    }
+
+    // compiles every word and then the top level tokens into program.main
+    void compile(std::vector<Token>& tokens)
+    {
+        for(auto &[name, body] : words)
+            declare(name);
+
+        for(uint32_t i = 0; i < program.words.size(); i++)
+        {
+            if(program.words[i].code.empty())
+                compile_word(i);
+        }
+
+        program.main.tokens = std::move(tokens);
+        compile_chunk(program.main, false);
+
+        fold::optimize(program.main, {}, fold_report);
+
+        fold::Constants  constants = fold::word_constants(program.main);
+        std::vector<bool> optimized(program.words.size(), false);
+
+        for(uint32_t i = 0; i < program.words.size(); i++)
+            optimize_word(i, constants, optimized);
+
+        optimize(program.main, inliner::NO_WORD, {});
+    }
+
+    // compiles a word the parser just added, words it calls must already be compiled
+    void compile_word(const std::string& name)
+    {
+        uint32_t index = declare(name);
+
+        compile_word(index);
+        optimize(program.words[index], index, {});
+    }
+
+    void compile_main(std::vector<Token>& tokens, Chunk& chunk)
+    {
+        chunk.tokens = std::move(tokens);
+        compile_chunk(chunk, false);
+        optimize(chunk, inliner::NO_WORD, {});
+    }
+
+private:
+    Program& program;
+    Words&   words;
+    uint32_t peephole;
+    bool     fold_report;
+    size_t   inline_size;
+    bool     inline_log;
+
+    // keyed by symbol
+    std::map<uint32_t, uint32_t> builtin_index;
+    std::map<uint32_t, uint32_t> word_index;
+    std::map<uint32_t, uint32_t> local_index;
+
+    std::vector<Control> control;
+    size_t               do_depth = 0;
+    bool                 in_word  = false;
+    uint32_t             loop_index_symbol;
+    uint32_t             to_r_symbol, r_from_symbol, r_fetch_symbol;
+
+    // gives a user word its index
+    uint32_t declare(const std::string& name)
+    {
+        uint32_t symbol = symbols.intern(name);
+
+        if(word_index.contains(symbol))
+            return word_index.at(symbol);
+
+        counters.words++;
+
+        word_index[symbol] = program.words.size();
+        program.word_names.push_back(name);
+        program.words.emplace_back();
+
+        return program.words.size()-1;
+    }
+
+    // builtins are only added to the program once something calls them,
+    // returns NO_SYMBOL for names that are not builtins
+    uint32_t builtin(uint32_t symbol)
+    {
+        if(builtin_index.contains(symbol))
+            return builtin_index.at(symbol);
+
+        const builtin_fn *fn = builtin_table.find(symbols.name(symbol));
+
+        if(!fn)
+            return NO_SYMBOL;
+
+        builtin_index[symbol] = program.builtins.size();
+        program.builtins.push_back(*fn);
+        program.builtin_names.push_back(symbols.name(symbol));
+
+        return program.builtins.size()-1;
+    }
+
+    void compile_word(uint32_t index)
+    {
+        Chunk& chunk = program.words[index];
+        chunk.tokens = words.at(program.word_names[index]);
+        compile_chunk(chunk, true);
+    }
+
+    void compile_chunk(Chunk& chunk, bool is_word)
+    {
+        control.clear();
+        local_index.clear();
+        do_depth = 0;
+        in_word  = is_word;
+
+        // every variable a word defines gets a local slot, so references
+        // before the definition resolve to the same slot
+        if(in_word)
+        {
+            for(auto &token : chunk.tokens)
+            {
+                if(token.type == VARIABLE || token.type == CONSTANT)
+                    add_local(chunk, token.symbol);
+                else if(token.type == LOCALS)
+                {
+                    for(uint32_t symbol : local_names(token))
+                        add_local(chunk, symbol);
+                }
+            }
+        }
+
+        for(uint32_t i = 0; i < chunk.tokens.size(); i++)
+            compile_token(chunk, i);
+
+        if(!control.empty())
+            logger::syntax_error(chunk.tokens[control.back().token], "invalid expression");
+
+        if(chunk.code.empty() || chunk.code.back().op != OpCode::RETURN)
+            emit(chunk, OpCode::RETURN, 0, chunk.tokens.empty() ? 0 : chunk.tokens.size()-1);
+    }
+
+    // constants are only known in a word when the whole program is compiled at once.
+    // `self` is the index of the word the chunk is the body of
+    void optimize(Chunk& chunk, uint32_t self, const fold::Constants& constants)
+    {
+        fold::optimize(chunk, constants, fold_report);
+
+        // copied bodies may have literals to fold with the code around them
+        if(inliner::expand(chunk, self, program, inline_size, inline_log))
+            fold::optimize(chunk, constants, fold_report);
+
+        peephole::optimize(chunk, program, peephole);
+
+        if(self != inliner::NO_WORD)
+            mark_tail_calls(chunk);
+    }
+
+    // a call with nothing but jumps between it and the return of the word
+    // becomes a tail call. a word with locals keeps its frame for the call,
+    // the callee may still hold references to them
+    void mark_tail_calls(Chunk& chunk)
+    {
+        if(!chunk.locals.empty())
+            return;
+
+        std::vector<Instruction>& code = chunk.code;
+
+        for(size_t i = 0; i < code.size(); i++)
+        {
+            if(code[i].op != OpCode::CALL_WORD)
+                continue;
+
+            size_t next = i + 1, hops = 0;
+
+            while(next < code.size() && code[next].op == OpCode::JUMP && hops++ < code.size())
+                next = code[next].operand;
+
+            if(next < code.size() && code[next].op == OpCode::RETURN)
+                code[i].op = OpCode::TAIL_CALL;
+        }
+    }
+
+    // words are optimized before the words that call them, so what gets
+    // inlined is already as small as it gets
+    void optimize_word(uint32_t index, const fold::Constants& constants, std::vector<bool>& optimized)
+    {
+        if(optimized[index])
+            return;
+
+        optimized[index] = true;
+
+        for(const Instruction& ins : program.words[index].code)
+        {
+            if(ins.op == OpCode::CALL_WORD)
+                optimize_word(ins.operand, constants, optimized);
+        }
+
+        optimize(program.words[index], index, constants);
+    }
+
+    void compile_token(Chunk& chunk, uint32_t i)
+    {
+        Token& token = chunk.tokens[i];
+
+        if(!token.value.is_none())
+        {
+            chunk.constants.push_back(token.value);
+            return emit(chunk, OpCode::PUSH, chunk.constants.size()-1, i);
+        }
+
+        switch(token.type)
+        {
+            case IDENTIFIER:    return compile_identifier(chunk, token, i);
+            case DOT:           return emit(chunk, OpCode::PRINT, 0, i);
+            case AT:            return emit(chunk, OpCode::FETCH, 0, i);
+            case QUESTION:      return emit(chunk, OpCode::PRINT_VAR, 0, i);
+            case PLUS:          return emit(chunk, OpCode::ADD, 0, i);
+            case MINUS:         return emit(chunk, OpCode::SUB, 0, i);
+            case STAR:          return emit(chunk, OpCode::MUL, 0, i);
+            case SLASH:         return emit(chunk, OpCode::DIV, 0, i);
+            case EQUAL:         return emit(chunk, OpCode::EQUAL, 0, i);
+            case BANG_EQUAL:    return emit(chunk, OpCode::NOT_EQUAL, 0, i);
+            case LESS_THEN:     return emit(chunk, OpCode::LESS, 0, i);
+            case GREATER_THEN:  return emit(chunk, OpCode::GREATER, 0, i);
+            case LESS_EQUAL:    return emit(chunk, OpCode::LESS_EQUAL, 0, i);
+            case GREATER_EQUAL: return emit(chunk, OpCode::GREATER_EQUAL, 0, i);
+            case AND:           return emit(chunk, OpCode::AND, 0, i);
+            case OR:            return emit(chunk, OpCode::OR, 0, i);
+            case INVERT:        return emit(chunk, OpCode::INVERT, 0, i);
+            case BANG:          return emit(chunk, OpCode::STORE, 0, i);
+            case PLUS_BANG:     return emit(chunk, OpCode::ADD_STORE, 0, i);
+            case MINUS_BANG:    return emit(chunk, OpCode::SUB_STORE, 0, i);
+            case STAR_BANG:     return emit(chunk, OpCode::MUL_STORE, 0, i);
+            case SLASH_BANG:    return emit(chunk, OpCode::DIV_STORE, 0, i);
+            case VARIABLE:
+            {
+                if(in_word)
+                    return emit(chunk, OpCode::DEFINE_LOCAL_VAR, local_index.at(token.symbol), i);
+                return emit(chunk, OpCode::DEFINE_VAR, program.global_slot(token.symbol), i);
+            }
+            case CONSTANT:
+            {
+                if(in_word)
+                    return emit(chunk, OpCode::DEFINE_LOCAL_CONST, local_index.at(token.symbol), i);
+                return emit(chunk, OpCode::DEFINE_CONST, program.global_slot(token.symbol), i);
+            }
+            case LOCALS:
+            {
+                auto names = local_names(token);
+
+                // the last name binds the top of the stack
+                for(size_t n = names.size(); n != 0; n--)
+                    emit(chunk, OpCode::DEFINE_LOCAL_VAR, local_index.at(names[n-1]), i);
+                return;
+            }
+            case END:           return emit(chunk, OpCode::RETURN, 0, i);
+            case IF:
+            {
+                control.push_back({IF, chunk.code.size(), 0, i});
+                return emit(chunk, OpCode::JUMP_IF_FALSE, 0, i);
+            }
+            case ELSE:
+            {
+                Control& ctl = expect(IF, token);
+
+                ctl.type = ELSE;
+                emit(chunk, OpCode::JUMP, 0, i);
+                patch(chunk, ctl.patch);
+                ctl.patch = chunk.code.size()-1;
+                return;
+            }
+            case THEN:
+            {
+                if(control.empty() || (control.back().type != IF && control.back().type != ELSE))
+                    logger::syntax_error(token, "invalid expression");
+
+                patch(chunk, control.back().patch);
+                control.pop_back();
+                return;
+            }
+            case BEGIN:
+            {
+                control.push_back({BEGIN, chunk.code.size(), chunk.code.size(), i});
+                return emit(chunk, OpCode::JUMP_IF_FALSE, 0, i);
+            }
+            case UNTIL:
+            {
+                Control ctl = expect(BEGIN, token);
+
+                control.pop_back();
+                emit(chunk, OpCode::JUMP, ctl.start, i);
+                return patch(chunk, ctl.patch);
+            }
+            case DO:
+            {
+                control.push_back({DO, chunk.code.size(), chunk.code.size()+1, i});
+                do_depth++;
+                return emit(chunk, OpCode::DO, 0, i);
+            }
+            case LOOP:
+            {
+                Control ctl = expect(DO, token);
+
+                control.pop_back();
+                do_depth--;
+                emit(chunk, OpCode::LOOP, ctl.start, i);
+                return patch(chunk, ctl.patch);
+            }
+            default: logger::syntax_error(token, "unexpected token");
+        }
+    }
+
+    void compile_identifier(Chunk& chunk, Token& token, uint32_t i)
+    {
+        if(do_depth && token.symbol == loop_index_symbol)
+            return emit(chunk, OpCode::LOOP_INDEX, 0, i);
+
+        if(word_index.contains(token.symbol))
+            return emit(chunk, OpCode::CALL_WORD, word_index.at(token.symbol), i);
+
+        if(token.symbol == to_r_symbol)    return emit(chunk, OpCode::TO_R, 0, i);
+        if(token.symbol == r_from_symbol)  return emit(chunk, OpCode::R_FROM, 0, i);
+        if(token.symbol == r_fetch_symbol) return emit(chunk, OpCode::R_FETCH, 0, i);
+
+        if(uint32_t index = builtin(token.symbol); index != NO_SYMBOL)
+            return emit(chunk, OpCode::CALL_BUILTIN, index, i);
+
+        if(local_index.contains(token.symbol))
+            return emit(chunk, OpCode::LOCAL_REF, local_index.at(token.symbol), i);
+
+        // unknown names still get a slot, referencing it before it is defined is a runtime error
+        emit(chunk, OpCode::GLOBAL_REF, program.global_slot(token.symbol), i);
+    }
+
+    inline void add_local(Chunk& chunk, uint32_t symbol)
+    {
+        if(local_index.contains(symbol))
+            return;
+
+        local_index[symbol] = chunk.locals.size();
+        chunk.locals.push_back(symbol);
+    }
+
+    // the names of a { a b -- comment } declaration, everything after -- is ignored
+    std::vector<uint32_t> local_names(const Token& token)
+    {
+        std::vector<uint32_t> names;
+        std::string_view      text = token.lexeme;
+
+        while(!text.empty())
+        {
+            size_t begin = text.find_first_not_of(" \t\r\n");
+
+            if(begin == std::string_view::npos)
+                break;
+
+            size_t end = text.find_first_of(" \t\r\n", begin);
+
+            std::string_view name = text.substr(begin, end - begin);
+
+            if(name == "--")
+                break;
+
+            names.push_back(symbols.intern(name));
+
+            text.remove_prefix(end == std::string_view::npos ? text.size() : end);
+        }
+
+        return names;
+    }
+
+    Control& expect(TokenType type, Token& token)
+    {
+        if(control.empty() || control.back().type != type)
+            logger::syntax_error(token, "invalid expression");
+        return control.back();
+    }
+
+    // points the jump at instruction `at` to the next instruction emitted
+    inline void patch(Chunk& chunk, size_t at)
+    {
+        chunk.code[at].operand = chunk.code.size();
+    }
+
+    inline void emit(Chunk& chunk, OpCode op, size_t operand, size_t token)
+    {
+        chunk.code.push_back({op, (uint32_t)operand});
+        chunk.token_of.push_back(token);
+    }
+};
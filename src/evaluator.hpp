@@ -1,265 +1,998 @@
 #pragma once
 
 #include <vector>
+#include <deque>
 #include <utility>
 #include <cstdio>
+#include <cstdint>
 #include <cstdlib>
 #include <iomanip>
 
 #include "types.hpp"
-#include "parser.hpp"
 #include "stack.hpp"
 #include "words.hpp"
+#include "bytecode.hpp"
+#include "options.hpp"
+#include "output.hpp"
+#include "arithmetic.hpp"
+#include "jit.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
 
 class Evaluator
 {
     using enum TokenType;
 
-    using VarTable = std::map<std::string, Token>;
+    // variables indexed by slot, a slot holding an END token is not defined yet.
+    // globals grow while streaming, a deque keeps references to them valid
+    using VarTable    = std::vector<Token>;
+    using GlobalTable = std::deque<Token>;
+
+    // loops count in integers unless a bound is a double
+    struct LoopState
+    {
+        int64_t index, end;
+        double  real_index, real_end;
+        bool    real;
+
+        Value value() const
+        {
+            return real ? Value(real_index) : Value(index);
+        }
+    };
+
+    // where a word called from the dispatch loop returns to
+    struct Frame
+    {
+        const Chunk *chunk;
+        size_t       ip;          // the call
+        Token       *locals;
+        size_t       locals_top;  // before the callee took its slots
+    };
 
 public:
-    Evaluator(Words& words, std::vector<Token>& tokens, int argc, char **argv)
-    : words(words), tokens(tokens)
+    Evaluator(Program& program, const Options& options)
+    : program(program),
+      engine(options.engine),
+      profiling(options.profile || options.alloc_profile),
+      global_variables(program.globals.size()),
+      local_variables(options.locals_size),
+      max_frames(options.return_stack_size)
+#if FORTH_JIT
+      , jit_threshold(options.jit_threshold),
+      jit_compiler(program, {jit_exec, jit_binary, jit_truthful, jit_compare,
+                             jit_call_word, jit_loop_begin, jit_loop_next, jit_loop_index}, stack)
+#endif
     {
-        global_variables.emplace("argc", Token(NUMBER, (double)argc));
+        global_variables[0] = Token(NUMBER, options.args.size());
 
         Array args;
 
-        args.reserve(argc);
+        args.reserve(options.args.size());
+
+        for(char *arg : options.args)
+            args.emplace_back(arg);
+
+        global_variables[1] = Token(ARRAY, std::move(args));
 
-        for(size_t i = 0; i < argc; i++)
-            args.emplace_back(argv[i]);
+        loops.reserve(64);
 
-        global_variables.emplace("argv", Token(ARRAY, std::move(args)));
+        stats.stack_peak = [this] { return stack.peak(); };
+    }
+
+    // the report may come after the evaluator is gone
+    ~Evaluator()
+    {
+        size_t peak = stack.peak();
+        stats.stack_peak = [peak] { return peak; };
     }
 
+    Evaluator(const Evaluator&) = delete;
+    Evaluator& operator=(const Evaluator&) = delete;
+
     void eval()
     {
-        for(auto &token : tokens)
+        run_statement(program.main);
+    }
+
+    // runs top level code, picking up any words and globals compiled since the last call
+    void run_statement(Chunk& chunk)
+    {
+        if(global_variables.size() < program.globals.size())
+            global_variables.resize(program.globals.size());
+
+#if FORTH_COMPUTED_GOTO
+        if(engine == Engine::THREADED)
         {
-            eval_token(token, global_variables);
+            for(; threaded_words < program.words.size(); threaded_words++)
+                thread(program.words[threaded_words]);
+
+            thread(chunk);
         }
+#endif
+        if(profiling)
+            profiler.enter(Profiler::TOP_LEVEL);
+
+        run(chunk, nullptr);
+
+        if(profiling)
+            profiler.leave();
     }
 
 private:
-    Words&              words;
-    std::vector<Token>& tokens;
-    Stack<Value>        stack;
+    Program&     program;
+    Engine       engine;
+    bool         profiling;  // the engines are built twice, once without any profiling code
+    Stack<Value> stack;
+
+    GlobalTable            global_variables;
+    std::vector<LoopState> loops;
+
+    // every word call takes a frame of its local slots off the top of this,
+    // it never grows so references into it stay valid
+    VarTable local_variables;
+    size_t   locals_top = 0;
+
+    // the return stack. words call each other inside one dispatch loop, so
+    // recursion grows this instead of the native stack. a word called from
+    // native code starts a loop of its own on top of the frames already here
+    Stack<Frame> frames;
+    size_t       max_frames;
 
-    VarTable global_variables;
+    // what >r takes off the data stack, kept apart from the frames so a word
+    // that leaves something behind cannot change where it returns to
+    std::vector<Value> return_values;
 
-    void eval_token(Token& token, VarTable& vars)
+#if FORTH_COMPUTED_GOTO
+    const void **handlers       = nullptr;
+    size_t       threaded_words = 0;
+#endif
+
+#if FORTH_JIT
+    // a word is compiled on the call that brings its count to the threshold,
+    // a word the jit cannot compile keeps its count and is never tried again
+    uint32_t                  jit_threshold;
+    jit::Compiler             jit_compiler;
+    std::vector<jit::Code>    jit_code;
+    std::vector<jit::Native>  native;  // indexed like program.words, null until compiled
+    std::vector<uint32_t>     calls;
+
+    // native code calling native code grows the native stack, past this
+    // many nested calls words are interpreted again
+    static constexpr size_t MAX_NATIVE_DEPTH = 1024;
+    size_t                  native_depth     = 0;
+#endif
+
+    // runs chunk until it returns, with every word it calls in the same loop
+    inline void run(const Chunk& chunk, Token *locals)
     {
-        if(token.value.index() != 0)
-            return stack.push(token.value);
+        size_t base = frames.len(), top = locals_top;
+
+#if FORTH_COMPUTED_GOTO
+        if(engine == Engine::THREADED)
+            profiling ? run_threaded<true>(&chunk, locals, base) : run_threaded<false>(&chunk, locals, base);
+        else
+#endif
+        profiling ? run_switch<true>(&chunk, locals, base) : run_switch<false>(&chunk, locals, base);
+
+        // a tail call may have replaced the word with one that has locals
+        locals_top = top;
+    }
 
-        if(token.type == IDENTIFIER)
+    template<bool PROFILE>
+    void run_switch(const Chunk *chunk, Token *locals, size_t base)
+    {
+        const Instruction *code = chunk->code.data();
+
+        for(size_t ip = 0;; ip++)
         {
-            if(words.contains(token.lexeme))
-                return run_word(token.lexeme);
-            else if(vars.contains(token.lexeme) || global_variables.contains(token.lexeme))
+            const Instruction& ins = code[ip];
+
+            counters.executed++;
+
+            switch(ins.op)
             {
-                stack.push(&vars[token.lexeme]);
+                case OpCode::JUMP: ip = (size_t)ins.operand - 1; break;
+                case OpCode::JUMP_IF_FALSE:
+                {
+                    if(!is_truthful())
+                        ip = (size_t)ins.operand - 1;
+                    break;
+                }
+                case OpCode::DO:
+                {
+                    if(!loop_begin(chunk->token_at(ip)))
+                        ip = (size_t)ins.operand - 1;
+                    break;
+                }
+                case OpCode::LOOP:
+                {
+                    if(loop_next())
+                        ip = (size_t)ins.operand - 1;
+                    break;
+                }
+                case OpCode::COMPARE_JUMP:
+                {
+                    if(!compare(packed_op(ins.operand), chunk->token_at(ip)))
+                        ip = (size_t)(ins.operand & PACKED_MASK) - 1;
+                    break;
+                }
+                case OpCode::CALL_WORD:
+                case OpCode::TAIL_CALL:
+                {
+                    if(const Chunk *word = enter<PROFILE>(ins.operand, ins.op == OpCode::TAIL_CALL, chunk, ip, locals))
+                    {
+                        chunk  = word;
+                        code   = chunk->code.data();
+                        locals = locals_of(*chunk);
+                        ip     = (size_t)-1;
+                    }
+                    break;
+                }
+                case OpCode::RETURN:
+                {
+                    if(frames.len() == base)
+                        return;
+
+                    Frame frame = leave<PROFILE>();
+
+                    chunk  = frame.chunk;
+                    code   = chunk->code.data();
+                    locals = frame.locals;
+                    ip     = frame.ip;
+                    break;
+                }
+                default: execute<PROFILE>(ins, *chunk, ip, locals);
             }
         }
+    }
+
+    // every instruction that does not change where the chunk goes next,
+    // the jit calls back in here for the ones it has no code of its own for
+    template<bool PROFILE>
+    inline void execute(const Instruction& ins, const Chunk& chunk, size_t ip, Token *locals)
+    {
+        switch(ins.op)
+        {
+            case OpCode::PUSH:          stack.push(chunk.constants[ins.operand]); break;
+            case OpCode::GLOBAL_REF:    push_var(global_variables[ins.operand], chunk, ip); break;
+            case OpCode::LOCAL_REF:     push_local(chunk, ip, ins.operand, locals); break;
+            case OpCode::DEFINE_VAR:    define_var(global_variables[ins.operand], chunk, ip, TokenType::VARIABLE); break;
+            case OpCode::DEFINE_CONST:  define_var(global_variables[ins.operand], chunk, ip, TokenType::CONSTANT); break;
+            case OpCode::DEFINE_LOCAL_VAR:   define_var(locals[ins.operand], chunk, ip, TokenType::VARIABLE); break;
+            case OpCode::DEFINE_LOCAL_CONST: define_var(locals[ins.operand], chunk, ip, TokenType::CONSTANT); break;
+            case OpCode::CALL_BUILTIN:  call_builtin<PROFILE>(ins.operand); break;
+            case OpCode::LOOP_INDEX:    stack.push(loops.back().value()); break;
+            case OpCode::TO_R:          to_r(chunk.token_at(ip)); break;
+            case OpCode::R_FROM:        r_from(chunk.token_at(ip), false); break;
+            case OpCode::R_FETCH:       r_from(chunk.token_at(ip), true); break;
+            case OpCode::PRINT:         print_top(chunk.token_at(ip)); break;
+            case OpCode::FETCH:         fetch(chunk.token_at(ip)); break;
+            case OpCode::PRINT_VAR:     print_var(chunk.token_at(ip)); break;
+            case OpCode::ADD:
+            case OpCode::SUB:
+            case OpCode::MUL:
+            case OpCode::DIV:
+            case OpCode::EQUAL:
+            case OpCode::NOT_EQUAL:
+            case OpCode::LESS:
+            case OpCode::GREATER:
+            case OpCode::LESS_EQUAL:
+            case OpCode::GREATER_EQUAL:
+            case OpCode::AND:
+            case OpCode::OR:
+                do_binary_arithmetic(ins.op, chunk.token_at(ip));
+                break;
+            case OpCode::INVERT: invert(chunk.token_at(ip)); break;
+            case OpCode::STORE:
+            case OpCode::ADD_STORE:
+            case OpCode::SUB_STORE:
+            case OpCode::MUL_STORE:
+            case OpCode::DIV_STORE:
+                do_var_op(ins.op, chunk.token_at(ip));
+                break;
+            case OpCode::LITERAL_OP:
+                literal_arithmetic(packed_op(ins.operand), chunk.constants[ins.operand & PACKED_MASK], chunk, ip);
+                break;
+            case OpCode::INCREMENT: step(OpCode::ADD, chunk, ip, ins.operand); break;
+            case OpCode::DECREMENT: step(OpCode::SUB, chunk, ip, ins.operand); break;
+            case OpCode::DUP_MUL:   square(chunk, ip); break;
+            case OpCode::OVER_OVER: over_over(); break;
+            case OpCode::FETCH_GLOBAL: fetch_var(global_variables[ins.operand], chunk, ip); break;
+            case OpCode::FETCH_LOCAL:  stack.push(local_var(chunk, ip, ins.operand, locals).value); break;
+            case OpCode::STORE_GLOBAL: store_global(global_variables[ins.operand], chunk, ip); break;
+            case OpCode::STORE_LOCAL:  store_var(local_var(chunk, ip, ins.operand, locals), chunk, ip); break;
+            default: break;
+        }
+    }
 
-        if(token.type > DOT && token.type < QUESTION)
-            return do_binary_arithmetic(token);
-        if(token.type > AT && token.type < AND)
-            return do_var_op(token);
+#if FORTH_COMPUTED_GOTO
+    // same semantics as run_switch, but every handler jumps straight to the next
+    // one so each opcode gets its own indirect branch
+    // called with a null chunk it only publishes its handler table
+    template<bool PROFILE>
+    void run_threaded(const Chunk *chunk, Token *locals, size_t base)
+    {
+        // must follow the order of OpCode
+        static const void *labels[] =
+        {
+            &&push, &&global_ref, &&local_ref, &&define_var, &&define_const,
+            &&define_local_var, &&define_local_const, &&call_builtin, &&call_word, &&tail_call, &&loop_index,
+            &&to_r, &&r_from, &&r_fetch,
+            &&print, &&fetch, &&print_var,
+            &&arithmetic, &&arithmetic, &&arithmetic, &&arithmetic,
+            &&arithmetic, &&arithmetic, &&arithmetic, &&arithmetic, &&arithmetic, &&arithmetic,
+            &&arithmetic, &&arithmetic, &&invert,
+            &&var_op, &&var_op, &&var_op, &&var_op, &&var_op,
+            &&jump, &&jump_if_false, &&do_, &&loop,
+            &&literal_op, &&increment, &&decrement, &&dup_mul, &&over_over, &&compare_jump,
+            &&fetch_global, &&fetch_local, &&store_global, &&store_local,
+            &&return_,
+        };
 
-        if(token.type != END && stack.empty())
-            logger::runtime_error(token, "stack is empty");
+        static_assert(sizeof(labels) / sizeof(*labels) == (size_t)OpCode::RETURN + 1);
 
-        switch(token.type)
+        if(!chunk)
         {
-            case DOT: print_top(token); break;
-            case VARIABLE:
-            {
-                token.value = std::move(stack.back());
+            handlers = labels;
+            return;
+        }
 
-                stack.pop();
+        const ThreadedInstruction *thread = chunk->threaded.data();
+        const ThreadedInstruction *ip     = thread;
 
-                vars[token.lexeme] = token;
+#define DISPATCH() do { counters.executed++; goto *ip->handler; } while(0)
+#define NEXT()     do { ip++; DISPATCH(); } while(0)
+#define IP         (size_t)(ip - thread)
 
-                break;
-            }
-            case AT:
-            {
-                Token *tk = get_var(token);
+// goes on in the called word unless it ran as native code
+#define ENTER(tail)                                                             \
+        do                                                                      \
+        {                                                                       \
+            const Chunk *word = enter<PROFILE>(ip->operand, tail, chunk, IP, locals); \
+                                                                                \
+            if(!word)                                                           \
+                NEXT();                                                         \
+                                                                                \
+            chunk  = word;                                                      \
+            locals = locals_of(*chunk);                                         \
+            thread = ip = chunk->threaded.data();                               \
+            DISPATCH();                                                         \
+        } while(0)
 
-                stack.pop();
-                stack.push(std::move(tk->value));
+        DISPATCH();
 
-                break;
+        push:          stack.push(chunk->constants[ip->operand]); NEXT();
+        global_ref:    push_var(global_variables[ip->operand], *chunk, IP); NEXT();
+        local_ref:     push_local(*chunk, IP, ip->operand, locals); NEXT();
+        define_var:    define_var(global_variables[ip->operand], *chunk, IP, TokenType::VARIABLE); NEXT();
+        define_const:  define_var(global_variables[ip->operand], *chunk, IP, TokenType::CONSTANT); NEXT();
+        define_local_var:   define_var(locals[ip->operand], *chunk, IP, TokenType::VARIABLE); NEXT();
+        define_local_const: define_var(locals[ip->operand], *chunk, IP, TokenType::CONSTANT); NEXT();
+        call_builtin:  call_builtin<PROFILE>(ip->operand); NEXT();
+        call_word:     ENTER(false);
+        tail_call:     ENTER(true);
+        loop_index:    stack.push(loops.back().value()); NEXT();
+        to_r:          to_r(chunk->token_at(IP)); NEXT();
+        r_from:        r_from(chunk->token_at(IP), false); NEXT();
+        r_fetch:       r_from(chunk->token_at(IP), true); NEXT();
+        print:         print_top(chunk->token_at(IP)); NEXT();
+        fetch:         fetch(chunk->token_at(IP)); NEXT();
+        print_var:     print_var(chunk->token_at(IP)); NEXT();
+        arithmetic:    do_binary_arithmetic(chunk->code[IP].op, chunk->token_at(IP)); NEXT();
+        invert:        invert(chunk->token_at(IP)); NEXT();
+        var_op:        do_var_op(chunk->code[IP].op, chunk->token_at(IP)); NEXT();
+        jump:          ip = thread + ip->operand; DISPATCH();
+        jump_if_false:
+        {
+            if(!is_truthful())
+            {
+                ip = thread + ip->operand;
+                DISPATCH();
+            }
+            NEXT();
+        }
+        do_:
+        {
+            if(!loop_begin(chunk->token_at(IP)))
+            {
+                ip = thread + ip->operand;
+                DISPATCH();
             }
-            case QUESTION:
+            NEXT();
+        }
+        loop:
+        {
+            if(loop_next())
             {
-                Token *tk = get_var(token);
+                ip = thread + ip->operand;
+                DISPATCH();
+            }
+            NEXT();
+        }
+        literal_op:
+            literal_arithmetic(packed_op(ip->operand), chunk->constants[ip->operand & PACKED_MASK], *chunk, IP);
+            NEXT();
+        increment:     step(OpCode::ADD, *chunk, IP, ip->operand); NEXT();
+        decrement:     step(OpCode::SUB, *chunk, IP, ip->operand); NEXT();
+        dup_mul:       square(*chunk, IP); NEXT();
+        over_over:     over_over(); NEXT();
+        compare_jump:
+        {
+            if(!compare(packed_op(ip->operand), chunk->token_at(IP)))
+            {
+                ip = thread + (ip->operand & PACKED_MASK);
+                DISPATCH();
+            }
+            NEXT();
+        }
+        fetch_global:  fetch_var(global_variables[ip->operand], *chunk, IP); NEXT();
+        fetch_local:   stack.push(local_var(*chunk, IP, ip->operand, locals).value); NEXT();
+        store_global:  store_global(global_variables[ip->operand], *chunk, IP); NEXT();
+        store_local:   store_var(local_var(*chunk, IP, ip->operand, locals), *chunk, IP); NEXT();
+        return_:
+        {
+            if(frames.len() == base)
+                return;
 
-                print_value(tk->value);
+            Frame frame = leave<PROFILE>();
 
-                stack.pop();
+            chunk  = frame.chunk;
+            locals = frame.locals;
+            thread = chunk->threaded.data();
+            ip     = thread + frame.ip;
+            NEXT();
+        }
 
-                break;
-            }
+#undef DISPATCH
+#undef NEXT
+#undef IP
+#undef ENTER
+    }
+
+    // replaces every opcode with its handler address before the chunk first
+    // runs, so word bodies are never touched while they run
+    void thread(Chunk& chunk)
+    {
+        if(!handlers)
+            profiling ? run_threaded<true>(nullptr, nullptr, 0) : run_threaded<false>(nullptr, nullptr, 0);
+
+        chunk.threaded.clear();
+        chunk.threaded.reserve(chunk.code.size());
+
+        for(auto &ins : chunk.code)
+            chunk.threaded.push_back({handlers[(size_t)ins.op], ins.operand});
+    }
+#endif
+
+    inline void push_var(Token& var, const Chunk& chunk, size_t ip)
+    {
+        counters.lookups++;
+
+        if(var.type == END)
+            logger::runtime_error(chunk.token_at(ip), "undefined identifier");
+
+        stack.push(&var);
+    }
+
+    // a local that is not defined yet still lets the global of the same name through
+    Token& local_var(const Chunk& chunk, size_t ip, uint32_t slot, Token *locals)
+    {
+        counters.lookups++;
+
+        if(locals[slot].type != END)
+            return locals[slot];
+
+        auto it = program.global_slots.find(chunk.locals[slot]);
+
+        if(it == program.global_slots.end() || global_variables[it->second].type == END)
+            logger::runtime_error(chunk.token_at(ip), "undefined identifier");
+
+        return global_variables[it->second];
+    }
+
+    inline void push_local(const Chunk& chunk, size_t ip, uint32_t slot, Token *locals)
+    {
+        stack.push(&local_var(chunk, ip, slot, locals));
+    }
+
+    // `name @` without the reference in between
+    inline void fetch_var(Token& var, const Chunk& chunk, size_t ip)
+    {
+        counters.lookups++;
+
+        if(var.type == END)
+            logger::runtime_error(chunk.token_at(ip), "undefined identifier");
+
+        stack.push(var.value);
+    }
+
+    // `name !`, errors of the store point at the `!`
+    inline void store_var(Token& var, const Chunk& chunk, size_t ip)
+    {
+        if(var.type == END)
+            logger::runtime_error(chunk.token_at(ip), "undefined identifier");
+
+        if(stack.empty())
+            logger::runtime_error(chunk.next_token_at(ip), "top value on stack is not a variable");
+
+        if(var.type == CONSTANT)
+            logger::runtime_error(chunk.next_token_at(ip), "cannot modify a constant");
+
+        var.value = std::move(stack.back());
+        stack.pop();
+    }
+
+    inline void store_global(Token& var, const Chunk& chunk, size_t ip)
+    {
+        counters.lookups++;
+        store_var(var, chunk, ip);
+    }
+
+    inline void define_var(Token& var, const Chunk& chunk, size_t ip, TokenType type)
+    {
+        if(stack.empty())
+            logger::runtime_error(chunk.token_at(ip), "stack is empty");
+
+        var.type  = type;
+        var.value = std::move(stack.back());
+
+        stack.pop();
+    }
+
+    // a frame of cleared local slots for a call of word
+    inline Token *take_locals(const Chunk& word)
+    {
+        size_t base = locals_top, size = word.locals.size();
+
+        if(base + size > local_variables.size())
+            logger::fatal("locals stack overflow, raise it with --locals=N");
+
+        Token *frame = &local_variables[base];
+
+        for(size_t i = 0; i < size; i++)
+        {
+            frame[i].type  = END;
+            frame[i].value = Value();
         }
+
+        locals_top += size;
+
+        return frame;
     }
 
-    void do_binary_arithmetic(Token& token)
+    // a call from the dispatch loop, which goes on in the returned word. a tail
+    // call pushes no frame, the callee returns to where its caller would have.
+    // returns null when the word ran as native code instead
+    template<bool PROFILE>
+    inline const Chunk *enter(uint32_t index, bool tail, const Chunk *chunk, size_t ip, Token *locals)
     {
-        if(stack.len() < 2)
-            logger::runtime_error(token, "stack state is invalid for binary operator");
+        const Chunk& word = program.words[index];
 
-        auto [a, b]   = top_nums(token);
-        double output = 0;
+#if FORTH_JIT
+        if(compiled(index, word))
+        {
+            call_word(index);
+            return nullptr;
+        }
+#endif
+        if(!tail)
+        {
+            if(frames.len() == max_frames)
+                logger::fatal("return stack overflow, raise it with --return-stack=N");
+
+            frames.push({chunk, ip, locals, locals_top});
+        }
 
-        switch(token.type)
+        if constexpr(PROFILE)
         {
-            case PLUS:          output = a + b; break;
-            case MINUS:         output = a - b; break;
-            case SLASH:         output = a / b; break;
-            case STAR:          output = a * b; break;
-            case EQUAL:         output = (a == b ? -1 : 0); break;
-            case BANG_EQUAL:    output = (a != b ? -1 : 0); break;
-            case LESS_THEN:     output = (a < b  ? -1 : 0); break;
-            case GREATER_THEN:  output = (a > b  ? -1 : 0); break;
-            case LESS_EQUAL:    output = (a <= b ? -1 : 0); break;
-            case GREATER_EQUAL: output = (a >= b ? -1 : 0); break;
-            default: logger::runtime_error(token, "invalid operator");
+            // a tail call replaces its caller in the profile as well
+            if(tail)
+                profiler.leave();
+
+            profile_enter(Profiler::word(index), program.word_names[index]);
         }
 
-        stack.pop_n(2);
-        stack.push(output);
+        return &word;
     }
 
-    void do_var_op(Token& token)
+    inline Token *locals_of(const Chunk& word)
     {
-        auto [a, b] = stack.top_two();
+        return word.locals.empty() ? nullptr : take_locals(word);
+    }
 
-        if(stack.len() < 2 && a.index() != 4 || b.index() != 4)
-            logger::runtime_error(token, "top value on stack is not a variable");
+    // pops the frame of the call the current word returns to
+    template<bool PROFILE>
+    inline Frame leave()
+    {
+        if constexpr(PROFILE)
+            profiler.leave();
 
-        Token *tk = std::get<Token*>(b);
+        Frame frame = frames.peek(0);
 
-        if(tk->type == CONSTANT)
-            logger::runtime_error(token, "cannot modify a constant");
+        locals_top = frame.locals_top;
+        frames.pop();
+
+        return frame;
+    }
+
+    template<bool PROFILE>
+    inline void call_builtin(uint32_t index)
+    {
+        if constexpr(PROFILE)
+            profile_enter(Profiler::builtin(index), program.builtin_names[index]);
+
+        program.builtins[index](stack);
 
-        double value = std::get<double>(a), current = std::get<double>(tk->value);
+        if constexpr(PROFILE)
+            profiler.leave();
+    }
+
+    // names only go to the profiler the first time something is called
+    inline void profile_enter(uint32_t function, const std::string& name)
+    {
+        if(!profiler.named(function))
+            profiler.name(function, name);
 
-        switch(token.type)
+        profiler.enter(function);
+    }
+
+    // a call from native code, the word runs in a loop of its own
+    inline void call_word(uint32_t index)
+    {
+        const Chunk& word = program.words[index];
+
+        size_t top = locals_top;
+
+        run_word(index, word, locals_of(word));
+        locals_top = top;
+    }
+
+    inline void run_word(uint32_t index, const Chunk& word, Token *locals)
+    {
+#if FORTH_JIT
+        if(jit::Native code = compiled(index, word))
         {
-            case BANG: tk->value = std::move(a);        break;
-            case PLUS_BANG: tk->value = current+value;  break;
-            case MINUS_BANG: tk->value = current-value; break;
-            case STAR_BANG: tk->value = current*value;  break;
-            case SLASH_BANG: tk->value = current/value; break;
+            native_depth++;
+            code(this, &word, locals);
+            native_depth--;
+            return;
         }
+#endif
+        run(word, locals);
+    }
+
+#if FORTH_JIT
+    // the native code of a word, compiled on the call that brings its count
+    // to the threshold. null while it is interpreted
+    inline jit::Native compiled(uint32_t index, const Chunk& word)
+    {
+        if(!jit_threshold || native_depth >= MAX_NATIVE_DEPTH)
+            return nullptr;
+
+        if(index >= native.size())
+        {
+            native.resize(program.words.size());
+            calls.resize(program.words.size());
+        }
+
+        if(!native[index] && calls[index] < jit_threshold && ++calls[index] == jit_threshold)
+            native[index] = jit_compiler.compile(word, index, jit_code);
+
+        return native[index];
+    }
+#endif
+
+    inline void to_r(const Token& token)
+    {
+        if(stack.empty())
+            logger::runtime_error(token, "stack is empty");
+
+        return_values.push_back(std::move(stack.back()));
+        stack.pop();
+    }
+
+    // r> moves the top of the return stack back, r@ copies it
+    inline void r_from(const Token& token, bool copy)
+    {
+        if(return_values.empty())
+            logger::runtime_error(token, "return stack is empty");
+
+        if(copy)
+            return stack.push(return_values.back());
+
+        stack.push(std::move(return_values.back()));
+        return_values.pop_back();
+    }
+
+#if FORTH_JIT
+    // entry points of native code back into the evaluator, see jit::Helper
+    static uint64_t jit_exec(void *self, const Chunk *chunk, Token *locals, uint64_t ip, void *)
+    {
+        ((Evaluator*)self)->execute<false>(chunk->code[ip], *chunk, ip, locals);
+        return 0;
+    }
+
+    static uint64_t jit_binary(void *self, const Chunk *chunk, Token *, uint64_t ip, void *)
+    {
+        ((Evaluator*)self)->do_binary_arithmetic(chunk->code[ip].op, chunk->token_at(ip));
+        return 0;
+    }
+
+    static uint64_t jit_truthful(void *self, const Chunk *, Token *, uint64_t, void *)
+    {
+        return ((Evaluator*)self)->is_truthful();
+    }
+
+    static uint64_t jit_compare(void *self, const Chunk *chunk, Token *, uint64_t ip, void *)
+    {
+        return ((Evaluator*)self)->compare(packed_op(chunk->code[ip].operand), chunk->token_at(ip));
+    }
+
+    static uint64_t jit_call_word(void *self, const Chunk *chunk, Token *, uint64_t ip, void *)
+    {
+        ((Evaluator*)self)->call_word(chunk->code[ip].operand);
+        return 0;
+    }
+
+    // integer loops move into the native frame, loops over doubles stay on the loop stack
+    static uint64_t jit_loop_begin(void *self, const Chunk *chunk, Token *, uint64_t ip, void *slot)
+    {
+        Evaluator& ev   = *(Evaluator*)self;
+        jit::Slot& into = *(jit::Slot*)slot;
+
+        if(!ev.loop_begin(chunk->token_at(ip)))
+            return false;
+
+        const LoopState& loop = ev.loops.back();
+
+        into.real = loop.real;
+
+        if(!loop.real)
+        {
+            into.index = loop.index;
+            into.end   = loop.end;
+            ev.loops.pop_back();
+        }
+
+        return true;
+    }
+
+    static uint64_t jit_loop_next(void *self, const Chunk *, Token *, uint64_t, void *)
+    {
+        return ((Evaluator*)self)->loop_next();
+    }
+
+    static uint64_t jit_loop_index(void *self, const Chunk *, Token *, uint64_t, void *slot)
+    {
+        Evaluator& ev   = *(Evaluator*)self;
+        jit::Slot& loop = *(jit::Slot*)slot;
+
+        ev.stack.push(loop.real ? ev.loops.back().value() : Value(loop.index));
+        return 0;
+    }
+#endif
+
+    inline void fetch(const Token& token)
+    {
+        Token *var = get_var(token);
+
+        stack.pop();
+        stack.push(var->value);
+    }
+
+    inline void print_var(const Token& token)
+    {
+        Token *var = get_var(token);
+
+        print_value(var->value);
+
+        stack.pop();
+    }
+
+    inline void invert(const Token& token)
+    {
+        if(stack.empty() || !stack.back().is_number())
+            logger::runtime_error(token, "top stack item is not a numeric value");
+
+        Value& top = stack.back();
+        top = ~top.to_int();
+    }
+
+    // returns false when the loop body should be skipped
+    inline bool loop_begin(const Token& token)
+    {
+        if(stack.len() < 2)
+            logger::runtime_error(token, "Stack is invalid state for do loop");
+
+        auto [end, begin] = stack.top_two();
+
+        if(!end.is_number() || !begin.is_number())
+            logger::runtime_error(token, "top two stack items are not numeric values");
+
+        LoopState loop{};
+
+        if(end.is_int() && begin.is_int())
+            loop = {begin.as_int(), end.as_int(), 0, 0, false};
+        else
+            loop = {0, 0, begin.as_number(), end.as_number(), true};
 
         stack.pop_n(2);
+
+        if(loop.real ? loop.real_index >= loop.real_end : loop.index >= loop.end)
+            return false;
+
+        loops.push_back(loop);
+
+        return true;
+    }
+
+    // returns true while the loop should keep running
+    inline bool loop_next()
+    {
+        LoopState& loop = loops.back();
+
+        if(loop.real ? ++loop.real_index < loop.real_end : ++loop.index < loop.end)
+            return true;
+
+        loops.pop_back();
+
+        return false;
     }
 
-    void run_word(std::string &word_name)
+    void do_binary_arithmetic(OpCode op, const Token& token)
     {
-        auto word = words.at(word_name);
+        if(stack.len() < 2)
+            logger::runtime_error(token, "stack state is invalid for binary operator");
+
+        auto [a, b] = stack.top_two();
+
+        // the result takes the place of a
+        if(a.is_int() && b.is_int())
+            a = int_arithmetic(op, a.as_int(), b.as_int(), token);
+        else if(a.is_number() && b.is_number())
+            a = arithmetic(op, a, b, token);
+        else
+            logger::runtime_error(token, "top two stack items are not numeric values");
+
+        stack.pop();
+    }
+
+    // `literal op`, the literal never goes on the stack
+    inline void literal_arithmetic(OpCode op, const Value& b, const Chunk& chunk, size_t ip)
+    {
+        if(stack.empty())
+            logger::runtime_error(chunk.next_token_at(ip), "stack state is invalid for binary operator");
+
+        Value& a = stack.back();
 
-        VarTable vars;
+        if(a.is_int() && b.is_int())
+            a = int_arithmetic(op, a.as_int(), b.as_int(), chunk.next_token_at(ip));
+        else if(a.is_number())
+            a = arithmetic(op, a, b, chunk.next_token_at(ip));
+        else
+            logger::runtime_error(chunk.next_token_at(ip), "top two stack items are not numeric values");
+    }
 
-        if(word.index() == 0)
+    // `1 +` and `1 -`
+    inline void step(OpCode op, const Chunk& chunk, size_t ip, uint32_t constant)
+    {
+        if(!stack.empty() && stack.back().is_int())
         {
-            builtin_fn fn = std::get<0>(word);
-            return fn(stack);
+            Value& a = stack.back();
+            a = (int64_t)((uint64_t)a.as_int() + (op == OpCode::ADD ? 1 : (uint64_t)-1));
+            return;
         }
 
-        std::vector<Token> word_tokens = std::get<1>(word);
+        literal_arithmetic(op, chunk.constants[constant], chunk, ip);
+    }
+
+    // `dup *`
+    inline void square(const Chunk& chunk, size_t ip)
+    {
+        if(stack.empty())
+            logger::runtime_error(chunk.next_token_at(ip), "stack state is invalid for binary operator");
+
+        Value& a = stack.back();
+
+        if(a.is_int())
+            a = int_arithmetic(OpCode::MUL, a.as_int(), a.as_int(), chunk.next_token_at(ip));
+        else if(a.is_number())
+            a = a.as_number() * a.as_number();
+        else
+            logger::runtime_error(chunk.next_token_at(ip), "top two stack items are not numeric values");
+    }
+
+    inline void over_over()
+    {
+        if(stack.len() < 2)
+            return;
+
+        stack.push(stack.peek(1));
+        stack.push(stack.peek(1));
+    }
 
-        for(size_t i = 0; i < word_tokens.size(); i++)
+    // a comparison followed by `if`, the flag stays on the stack like it does for `if`
+    inline bool compare(OpCode op, const Token& token)
+    {
+        if(stack.len() >= 2)
         {
-            Token& token = word_tokens[i];
+            auto [a, b] = stack.top_two();
 
-            switch(token.type)
+            if(a.is_int() && b.is_int())
             {
-                case IF:
-                {
-                    bool truthful = is_truthful();
+                bool flag = int_arithmetic(op, a.as_int(), b.as_int(), token).as_int() != 0;
+                a = flag ? -1 : 0;
+                stack.pop();
+                return flag;
+            }
+        }
 
-                    auto at_end = [&i, &word_tokens] () -> bool
-                    {
-                        return i < word_tokens.size() && word_tokens[i].type != THEN;
-                    };
+        do_binary_arithmetic(op, token);
 
-                    if(truthful)
-                    {
-                        while(at_end())
-                        {
-                            if(word_tokens[i].type == ELSE)
-                            {
-                                while(at_end())
-                                    i++;
-                                break;
-                            }
-                            eval_token(word_tokens[i++], vars);
-                        }
-                    }
-                    else
-                    {
-                        while(at_end())
-                        {
-                            if(word_tokens[i].type == ELSE)
-                            {
-                                while(at_end())
-                                    eval_token(word_tokens[i++], vars);
-                                break;
-                            }
-                            i++;
-                        }
-                    }
-                    break;
-                }
-                case BEGIN:
-                {
-                    i++;
-                    size_t start = i;
-                    while(is_truthful())
-                    {
-                        while(word_tokens[i].type != UNTIL)
-                            eval_token(word_tokens[i++], vars);
-                        i = start;
-                    }
-                    break;
-                }
-                case DO:
-                {
-                    i++;
-                    size_t start = i;
+        return is_truthful();
+    }
 
-                    if(stack.len() < 2)
-                        logger::runtime_error(word_tokens[i], "Stack is invalid state for do loop");
+    void do_var_op(OpCode op, const Token& token)
+    {
+        if(stack.len() < 2 || !stack.back().is_var())
+            logger::runtime_error(token, "top value on stack is not a variable");
 
-                    auto [end, begin] = top_nums(word_tokens[i]);
+        auto [a, b] = stack.top_two();
 
-                    stack.pop_n(2);
+        Token *tk = b.as_var();
 
-                    for(; begin < end; begin++)
-                    {
-                        while(word_tokens[i].type != LOOP)
-                        {
-                            if(word_tokens[i].lexeme == "i")
-                                stack.push((double)begin);
-                            else
-                                eval_token(word_tokens[i], vars);
-                            i++;
-                        }
-                        i = start;
-                    }
-                    break;
-                }
-                default: eval_token(token, vars);
-            }
+        if(tk->type == CONSTANT)
+            logger::runtime_error(token, "cannot modify a constant");
+
+        if(op == OpCode::STORE)
+        {
+            tk->value = std::move(a);
+            return stack.pop_n(2);
+        }
+
+        // +! appends to strings and arrays
+        if(op == OpCode::ADD_STORE && tk->value.is_string() && a.is_string())
+        {
+            tk->value.unique_string() += a.as_string();
+            return stack.pop_n(2);
+        }
+
+        if(op == OpCode::ADD_STORE && tk->value.is_numbers() && a.is_number())
+        {
+            tk->value.unique_numbers().push_back(a.as_number());
+            return stack.pop_n(2);
+        }
+
+        if(op == OpCode::ADD_STORE && tk->value.is_numbers())
+        {
+            const Numbers& numbers = tk->value.as_numbers();
+
+            tk->value = Array(numbers.begin(), numbers.end());
+        }
+
+        if(op == OpCode::ADD_STORE && tk->value.is_array())
+        {
+            tk->value.unique_array().push_back(a);
+            return stack.pop_n(2);
         }
+
+        if(!a.is_number() || !tk->value.is_number())
+            logger::runtime_error(token, "variable and value must be numeric");
+
+        switch(op)
+        {
+            case OpCode::ADD_STORE: tk->value = arithmetic(OpCode::ADD, tk->value, a, token); break;
+            case OpCode::SUB_STORE: tk->value = arithmetic(OpCode::SUB, tk->value, a, token); break;
+            case OpCode::MUL_STORE: tk->value = arithmetic(OpCode::MUL, tk->value, a, token); break;
+            case OpCode::DIV_STORE: tk->value = arithmetic(OpCode::DIV, tk->value, a, token); break;
+            default: break;
+        }
+
+        stack.pop_n(2);
     }
 
-    inline void print_top(Token& token)
+    inline void print_top(const Token& token)
     {
         if(stack.empty())
             logger::runtime_error(token, "Stack is empty");
@@ -273,11 +1006,12 @@ private:
 
     inline void print_value(Value& val)
     {
-        switch(val.index())
-        {
-            case 1: std::cout << std::get<double>(val); break;
-            case 2: std::cout << std::get<std::string>(val); break;
-        }
+        if(val.is_int())
+            output.integer(val.as_int());
+        else if(val.is_number())
+            output.number(val.as_number());
+        else if(val.is_string())
+            output.write(val.as_string());
     }
 
     inline bool is_truthful()
@@ -287,29 +1021,22 @@ private:
 
         Value& top = stack.back();
 
-        if(top.index() != 1)
-            return false;
+        if(top.is_int())
+            return top.as_int() != 0;
 
-        return std::get<double>(top) != 0;
+        return top.is_number() && top.as_number() != 0;
     }
 
-    std::pair<double, double> top_nums(Token& token)
+    Token *get_var(const Token& token)
     {
-        auto [v_a, v_b] = stack.top_two();
-
-        if(v_a.index() != 1 || v_b.index() != 1)
-            logger::runtime_error(token, "top two stack items are not numeric values");
-
-        return {std::get<double>(v_a), std::get<double>(v_b)};
-    }
+        if(stack.empty())
+            logger::runtime_error(token, "stack is empty");
 
-    Token *get_var(Token& token)
-    {
         Value &val = stack.back();
 
-        if(val.index() != 4)
-            logger::runtime_error(token, "top value on stack is not a variable ", val.index());
+        if(!val.is_var())
+            logger::runtime_error(token, "top value on stack is not a variable");
 
-        return std::get<Token*>(val);
+        return val.as_var();
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,339 @@
+#pragma once
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "types.hpp"
+#include "log.hpp"
+#include "bytecode.hpp"
+#include "arithmetic.hpp"
+
+// evaluates what the compiler can see the result of before the program runs:
+// operators on literals, `@` of constants defined from literals, and `if`
+// on a known flag. the branch an `if` never takes and any other code nothing
+// reaches is dropped afterwards
+namespace fold
+{
+    // global slot to the value of a constant, for the slots known in a chunk
+    using Constants = std::unordered_map<uint32_t, Value>;
+
+    // an instruction while folding, with the tokens it was folded from
+    struct Folded
+    {
+        Instruction ins;
+        uint32_t    first, last;
+        bool        target;  // something jumps to it
+    };
+
+    inline std::string describe(const Value& value)
+    {
+        std::ostringstream text;
+
+        if(value.is_int())
+            text << value.as_int();
+        else
+            text << value.as_number();
+
+        return text.str();
+    }
+
+    // the source text from the first token to the last. an inlined body can
+    // put them out of source order, then only the last one is shown
+    inline std::string_view span(const Chunk& chunk, uint32_t first, uint32_t last)
+    {
+        const std::string_view &a = chunk.tokens[first].lexeme, &b = chunk.tokens[last].lexeme;
+
+        if(b.data() < a.data())
+            return b;
+
+        return {a.data(), size_t(b.data() + b.size() - a.data())};
+    }
+
+    // drops the instructions `keep` is false for, jumps to a dropped one go to the next kept one
+    inline void compact(Chunk& chunk, const std::vector<bool>& keep)
+    {
+        std::vector<uint32_t> moved(chunk.code.size() + 1);
+
+        size_t kept = 0;
+
+        for(size_t i = 0; i < chunk.code.size(); i++)
+        {
+            moved[i] = kept;
+
+            if(keep[i])
+            {
+                chunk.code[kept]     = chunk.code[i];
+                chunk.token_of[kept] = chunk.token_of[i];
+                kept++;
+            }
+        }
+
+        moved[chunk.code.size()] = kept;
+
+        chunk.code.resize(kept);
+        chunk.token_of.resize(kept);
+
+        for(Instruction& ins : chunk.code)
+        {
+            if(is_jump(ins.op))
+                ins.set_index(moved[ins.index()]);
+        }
+    }
+
+    class Folder
+    {
+    public:
+        Folder(Chunk& chunk, const Constants& known, bool report)
+        : chunk(chunk), known(known), report(report)
+        {}
+
+        void run()
+        {
+            fold();
+            remove_unreachable();
+        }
+
+    private:
+        Chunk&    chunk;
+        Constants known;
+        bool      report;
+
+        std::vector<Folded> out;
+
+        const Value *literal(const Folded& f)
+        {
+            if(f.ins.op != OpCode::PUSH || !chunk.constants[f.ins.operand].is_number())
+                return nullptr;
+            return &chunk.constants[f.ins.operand];
+        }
+
+        // replaces the last `count` instructions with a push of value
+        void replace(size_t count, Value value, uint32_t last)
+        {
+            Folded folded = out[out.size() - count];
+
+            chunk.constants.push_back(std::move(value));
+
+            out.resize(out.size() - count);
+            out.push_back({{OpCode::PUSH, uint32_t(chunk.constants.size() - 1)}, folded.first, last, folded.target});
+        }
+
+        void fold()
+        {
+            const std::vector<Instruction>& code = chunk.code;
+
+            std::vector<bool> targets(code.size() + 1, false);
+
+            for(const Instruction& ins : code)
+            {
+                if(is_jump(ins.op))
+                    targets[ins.index()] = true;
+            }
+
+            std::vector<uint32_t> moved(code.size() + 1);
+
+            out.reserve(code.size());
+
+            for(size_t i = 0; i < code.size(); i++)
+            {
+                moved[i] = out.size();
+
+                const Instruction& ins   = code[i];
+                const uint32_t     token = chunk.token_of[i];
+
+                // nothing jumps between these and the instruction before them
+                bool joined = !targets[i] && !out.empty();
+
+                if(joined && ins.op >= OpCode::ADD && ins.op <= OpCode::OR && out.size() >= 2 && !out.back().target)
+                {
+                    const Value *a = literal(out[out.size() - 2]), *b = literal(out.back());
+
+                    if(a && b)
+                    {
+                        uint32_t first = out[out.size() - 2].first;
+                        Value    value = arithmetic(ins.op, *a, *b, chunk.tokens[token]);
+
+                        if(report)
+                            logger::note(chunk.tokens[first], "folded '", span(chunk, first, token), "' to ", describe(value));
+
+                        replace(2, std::move(value), token);
+                        continue;
+                    }
+                }
+
+                if(joined && ins.op == OpCode::INVERT)
+                {
+                    if(const Value *a = literal(out.back()))
+                    {
+                        uint32_t first = out.back().first;
+                        Value    value = ~a->to_int();
+
+                        if(report)
+                            logger::note(chunk.tokens[first], "folded '", span(chunk, first, token), "' to ", describe(value));
+
+                        replace(1, std::move(value), token);
+                        continue;
+                    }
+                }
+
+                if(joined && ins.op == OpCode::FETCH && out.back().ins.op == OpCode::GLOBAL_REF)
+                {
+                    auto it = known.find(out.back().ins.operand);
+
+                    if(it != known.end())
+                    {
+                        uint32_t first = out.back().first;
+
+                        if(report)
+                            logger::note(chunk.tokens[first], "constant '", chunk.tokens[first].lexeme, "' is ", describe(it->second));
+
+                        replace(1, it->second, token);
+                        continue;
+                    }
+                }
+
+                // `if` does not pop its flag, so a known one only decides where it goes
+                if(joined && ins.op == OpCode::JUMP_IF_FALSE)
+                {
+                    if(const Value *flag = literal(out.back()))
+                    {
+                        bool taken = flag->is_int() ? flag->as_int() != 0 : flag->as_number() != 0;
+
+                        if(report)
+                            logger::note(chunk.tokens[token], "'", chunk.tokens[token].lexeme, "' is always ", taken ? "true" : "false");
+
+                        if(taken)
+                            continue;
+
+                        out.push_back({{OpCode::JUMP, ins.operand}, token, token, false});
+                        continue;
+                    }
+                }
+
+                // main is straight line code, so a constant defined from a literal
+                // keeps that value until its slot is defined again
+                if(ins.op == OpCode::DEFINE_CONST || ins.op == OpCode::DEFINE_VAR)
+                {
+                    const Value *value = joined && ins.op == OpCode::DEFINE_CONST ? literal(out.back()) : nullptr;
+
+                    if(value)
+                        known.insert_or_assign(ins.operand, *value);
+                    else
+                        known.erase(ins.operand);
+                }
+
+                out.push_back({ins, token, token, targets[i]});
+            }
+
+            moved[code.size()] = out.size();
+
+            chunk.code.clear();
+            chunk.token_of.clear();
+
+            for(Folded& f : out)
+            {
+                if(is_jump(f.ins.op))
+                    f.ins.set_index(moved[f.ins.index()]);
+
+                chunk.code.push_back(f.ins);
+                chunk.token_of.push_back(f.last);
+            }
+        }
+
+        // walks every path from the start, then drops what it never got to
+        // and jumps to the instruction right after them
+        void remove_unreachable()
+        {
+            const std::vector<Instruction>& code = chunk.code;
+
+            std::vector<bool>     reached(code.size(), false);
+            std::vector<uint32_t> work{0};
+
+            while(!work.empty())
+            {
+                uint32_t ip = work.back();
+                work.pop_back();
+
+                if(ip >= code.size() || reached[ip])
+                    continue;
+
+                reached[ip] = true;
+
+                OpCode op = code[ip].op;
+
+                if(is_jump(op))
+                    work.push_back(code[ip].index());
+
+                if(op != OpCode::JUMP && op != OpCode::RETURN)
+                    work.push_back(ip + 1);
+            }
+
+            std::vector<bool> keep = reached;
+            size_t            dropped = 0;
+
+            for(size_t i = 0; i < code.size(); i++)
+            {
+                if(!reached[i])
+                {
+                    dropped++;
+                    continue;
+                }
+
+                if(code[i].op != OpCode::JUMP)
+                    continue;
+
+                size_t next = i + 1;
+
+                while(next < code.size() && !reached[next])
+                    next++;
+
+                if(code[i].operand == next)
+                    keep[i] = false;
+            }
+
+            if(report && dropped)
+                logger::note(chunk.token_at(0), "removed ", dropped, " unreachable instructions");
+
+            compact(chunk, keep);
+        }
+    };
+
+    inline void optimize(Chunk& chunk, const Constants& known, bool report)
+    {
+        Folder(chunk, known, report).run();
+    }
+
+    // main runs before any word does, so a constant it defines once from a
+    // literal before it calls anything has that value in every word
+    inline Constants word_constants(const Chunk& main)
+    {
+        Constants                              constants;
+        std::unordered_map<uint32_t, uint32_t> defined;
+
+        bool called = false;
+
+        for(size_t i = 0; i < main.code.size(); i++)
+        {
+            const Instruction& ins = main.code[i];
+
+            called |= ins.op == OpCode::CALL_WORD;
+
+            if(ins.op != OpCode::DEFINE_CONST && ins.op != OpCode::DEFINE_VAR)
+                continue;
+
+            const Instruction *value = i > 0 ? &main.code[i - 1] : nullptr;
+
+            if(defined[ins.operand]++ == 0 && !called && ins.op == OpCode::DEFINE_CONST &&
+               value && value->op == OpCode::PUSH && main.constants[value->operand].is_number())
+                constants.emplace(ins.operand, main.constants[value->operand]);
+            else
+                constants.erase(ins.operand);
+        }
+
+        return constants;
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "types.hpp"
+#include "log.hpp"
+#include "bytecode.hpp"
+
+// replaces calls to small words with a copy of their body. the copy brings
+// its own constants and tokens along, so errors inside it still point at the
+// word's source. words cannot be redefined (see Parser::scan_word), so a copy
+// never goes stale
+namespace inliner
+{
+    // index of the chunk being inlined into when it is not a word
+    static constexpr uint32_t NO_WORD = UINT32_MAX;
+
+    // the instructions a copy of the word takes, its last return is left out
+    inline size_t body_size(const Chunk& word)
+    {
+        return word.code.size() - (word.code.back().op == OpCode::RETURN);
+    }
+
+    // why `callee` is not inlined into `caller`, nullptr when it is
+    inline const char *reject(const Program& program, uint32_t caller, uint32_t callee)
+    {
+        const Chunk& word = program.words[callee];
+
+        if(callee == caller)
+            return "it calls itself";
+
+        // a frame is set up for these on every call
+        if(!word.locals.empty())
+            return "it has locals";
+
+        for(const Instruction& ins : word.code)
+        {
+            if(is_call(ins.op) && ins.operand == callee)
+                return "it calls itself";
+        }
+
+        return nullptr;
+    }
+
+    // returns true when any call was inlined
+    inline bool expand(Chunk& chunk, uint32_t self, const Program& program, size_t limit, bool log)
+    {
+        if(limit == 0)
+            return false;
+
+        std::vector<Instruction> code;
+        std::vector<uint32_t>    token_of;
+        std::vector<uint32_t>    moved(chunk.code.size() + 1);  // old index to new index
+
+        bool expanded = false;
+
+        for(size_t i = 0; i < chunk.code.size(); i++)
+        {
+            moved[i] = code.size();
+
+            const Instruction& ins = chunk.code[i];
+
+            if(ins.op != OpCode::CALL_WORD)
+            {
+                code.push_back(ins);
+                token_of.push_back(chunk.token_of[i]);
+                continue;
+            }
+
+            const Token& call   = chunk.token_at(i);
+            const char  *reason = reject(program, self, ins.operand);
+            const Chunk& word   = program.words[ins.operand];
+
+            size_t base      = code.size();
+            size_t constants = chunk.constants.size();
+            size_t tokens    = chunk.tokens.size();
+            size_t length    = body_size(word);
+
+            if(!reason && length > limit)
+                reason = "its body is over the size limit";
+
+            // packed operands only have room for 24 bits
+            if(!reason && (base + word.code.size() > PACKED_MASK || constants + word.constants.size() > PACKED_MASK))
+                reason = "the caller is too large";
+
+            if(reason)
+            {
+                if(log)
+                    logger::note(call, "not inlined '", call.lexeme, "', ", reason, " (", length, " of ", limit, " instructions)");
+
+                code.push_back(ins);
+                token_of.push_back(chunk.token_of[i]);
+                continue;
+            }
+
+            if(log)
+                logger::note(call, "inlined '", call.lexeme, "' (", length, " of ", limit, " instructions)");
+
+            chunk.constants.insert(chunk.constants.end(), word.constants.begin(), word.constants.end());
+            chunk.tokens.insert(chunk.tokens.end(), word.tokens.begin(), word.tokens.end());
+
+            // a return inside the body goes to the end of the copy
+            size_t end = base + length;
+
+            for(size_t at = 0; at < length; at++)
+            {
+                Instruction copy = word.code[at];
+
+                if(is_jump(copy.op))
+                    copy.set_index(base + copy.index());
+                else if(uses_constant(copy.op))
+                    copy.set_index(constants + copy.index());
+                else if(copy.op == OpCode::RETURN)
+                    copy = {OpCode::JUMP, (uint32_t)end};
+                else if(copy.op == OpCode::TAIL_CALL)
+                    copy.op = OpCode::CALL_WORD;  // the copy returns into its caller
+
+                code.push_back(copy);
+                token_of.push_back(tokens + word.token_of[at]);
+            }
+
+            expanded = true;
+        }
+
+        if(!expanded)
+            return false;
+
+        moved[chunk.code.size()] = code.size();
+
+        // only jumps of the caller still hold old indexes
+        for(size_t i = 0; i < chunk.code.size(); i++)
+        {
+            if(is_jump(chunk.code[i].op))
+                code[moved[i]].set_index(moved[chunk.code[i].index()]);
+        }
+
+        chunk.code     = std::move(code);
+        chunk.token_of = std::move(token_of);
+
+        return true;
+    }
+}
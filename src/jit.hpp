@@ -0,0 +1,792 @@
+#pragma once
+
+#include "options.hpp"
+
+#if FORTH_JIT
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "types.hpp"
+#include "bytecode.hpp"
+#include "stack.hpp"
+
+// compiles hot word bodies to x86-64. the data stack stays where it is, the
+// generated code reaches its first, last and limit pointers through r14 and
+// does the common integer cases itself: pushing literals, arithmetic and
+// comparisons on integers that fit in the payload, branches, and do loops
+// whose counters live in the native frame. anything else, and every case the
+// fast paths bail out of, calls back into the evaluator through one helper
+// signature, so the behaviour and error messages are the interpreter's own
+namespace jit
+{
+    // every call from native code back into the evaluator goes through this:
+    // the evaluator, the chunk being run, its locals, the instruction index
+    // and the loop slot of the instruction if it has one
+    using Helper = uint64_t(*)(void *context, const Chunk *chunk, Token *locals, uint64_t ip, void *slot);
+
+    struct Helpers
+    {
+        Helper exec;        // runs any instruction that is not control flow
+        Helper binary;      // a binary operator
+        Helper truthful;    // the flag `if` tests
+        Helper compare;     // the compare of a compare-jump, returns its flag
+        Helper call_word;
+        Helper loop_begin;  // returns false when the body is skipped
+        Helper loop_next;   // a loop over doubles, returns true while it runs
+        Helper loop_index;
+    };
+
+    // the state of one do loop. loops over doubles stay on the evaluator's
+    // loop stack and only mark themselves here as real
+    struct Slot
+    {
+        int64_t  index, end;
+        uint64_t real;
+    };
+
+    using Native = void(*)(void *context, const Chunk *chunk, Token *locals);
+
+    // an executable mapping holding one compiled word
+    class Code
+    {
+    public:
+        explicit Code(const std::vector<uint8_t>& bytes)
+        {
+            size_t page = sysconf(_SC_PAGESIZE);
+
+            size = (bytes.size() + page - 1) / page * page;
+
+            void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if(memory == MAP_FAILED)
+                return;
+
+            std::memcpy(memory, bytes.data(), bytes.size());
+
+            if(mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+            {
+                munmap(memory, size);
+                return;
+            }
+
+            start = memory;
+        }
+
+        Code(Code&& other) noexcept
+        : start(std::exchange(other.start, nullptr)), size(other.size)
+        {}
+
+        Code(const Code&) = delete;
+        Code& operator=(const Code&) = delete;
+        Code& operator=(Code&&) = delete;
+
+        ~Code()
+        {
+            if(start)
+                munmap(start, size);
+        }
+
+        Native entry() const
+        {
+            return (Native)start;
+        }
+
+    private:
+        void  *start = nullptr;
+        size_t size  = 0;
+    };
+
+    enum Reg : uint8_t
+    {
+        RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+        R8, R9, R10, R11, R12, R13, R14, R15,
+    };
+
+    enum Cond : uint8_t
+    {
+        OVERFLOW = 0x0, EQ = 0x4, NE = 0x5, LT = 0xC, GE = 0xD, LE = 0xE, GT = 0xF,
+    };
+
+    // the few x86-64 encodings the compiler needs. memory operands are
+    // always [base + disp32]
+    class Assembler
+    {
+    public:
+        std::vector<uint8_t> bytes;
+
+        size_t label()
+        {
+            labels.push_back(NOT_BOUND);
+            return labels.size() - 1;
+        }
+
+        void bind(size_t label)
+        {
+            labels[label] = bytes.size();
+        }
+
+        // false when a jump goes to a label that was never bound
+        bool resolve()
+        {
+            for(auto [at, label] : fixups)
+            {
+                if(labels[label] == NOT_BOUND)
+                    return false;
+
+                int32_t rel = (int32_t)(labels[label] - (at + 4));
+                std::memcpy(&bytes[at], &rel, 4);
+            }
+            return true;
+        }
+
+        // op r/m64, r64 for mov 0x89, add 0x01, sub 0x29, cmp 0x39, and 0x21, or 0x09, test 0x85
+        void rr(uint8_t opcode, Reg rm, Reg reg)
+        {
+            rex(true, reg, rm);
+            byte(opcode);
+            byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+        }
+
+        void mov(Reg dst, Reg src) { rr(0x89, dst, src); }
+
+        // op r64, [base + disp] for mov 0x8B, cmp 0x3B, sub 0x2B
+        void rm(uint8_t opcode, Reg reg, Reg base, int32_t disp)
+        {
+            rex(true, reg, base);
+            byte(opcode);
+            memory(reg, base, disp);
+        }
+
+        void load(Reg dst, Reg base, int32_t disp)  { rm(0x8B, dst, base, disp); }
+        void store(Reg base, int32_t disp, Reg src) { rm(0x89, src, base, disp); }
+        void lea(Reg dst, Reg base, int32_t disp)   { rm(0x8D, dst, base, disp); }
+
+        // group 1 with an imm32: add 0, or 1, and 4, sub 5, cmp 7
+        void imm(uint8_t ext, Reg reg, int32_t value)
+        {
+            rex(true, RAX, reg);
+            byte(0x81);
+            byte(0xC0 | ext << 3 | (reg & 7));
+            dword(value);
+        }
+
+        void imm(uint8_t ext, Reg base, int32_t disp, int32_t value)
+        {
+            rex(true, RAX, base);
+            byte(0x81);
+            memory((Reg)ext, base, disp);
+            dword(value);
+        }
+
+        void mov(Reg dst, uint64_t value)
+        {
+            rex(true, RAX, dst);
+            byte(0xB8 + (dst & 7));
+            std::memcpy(grow(8), &value, 8);
+        }
+
+        // zero extends to 64 bits
+        void mov32(Reg dst, uint32_t value)
+        {
+            rex(false, RAX, dst);
+            byte(0xB8 + (dst & 7));
+            dword(value);
+        }
+
+        void imul(Reg dst, Reg src)
+        {
+            rex(true, dst, src);
+            byte(0x0F);
+            byte(0xAF);
+            byte(0xC0 | (dst & 7) << 3 | (src & 7));
+        }
+
+        // shl 4, shr 5, sar 7
+        void shift(uint8_t ext, Reg reg, uint8_t count)
+        {
+            rex(true, RAX, reg);
+            byte(0xC1);
+            byte(0xC0 | ext << 3 | (reg & 7));
+            byte(count);
+        }
+
+        void neg(Reg reg)
+        {
+            rex(true, RAX, reg);
+            byte(0xF7);
+            byte(0xD8 | (reg & 7));
+        }
+
+        // rax = 1 when cond holds, else 0
+        void set(Cond cond)
+        {
+            byte(0x0F); byte(0x90 | cond); byte(0xC0);
+            byte(0x0F); byte(0xB6); byte(0xC0);
+        }
+
+        void test_al()
+        {
+            byte(0x84); byte(0xC0);
+        }
+
+        void call(Reg reg)
+        {
+            rex(false, RAX, reg);
+            byte(0xFF);
+            byte(0xD0 | (reg & 7));
+        }
+
+        void push(Reg reg)
+        {
+            rex(false, RAX, reg);
+            byte(0x50 + (reg & 7));
+        }
+
+        void pop(Reg reg)
+        {
+            rex(false, RAX, reg);
+            byte(0x58 + (reg & 7));
+        }
+
+        void ret() { byte(0xC3); }
+
+        void jump(size_t label)
+        {
+            byte(0xE9);
+            fixup(label);
+        }
+
+        void jump(Cond cond, size_t label)
+        {
+            byte(0x0F);
+            byte(0x80 | cond);
+            fixup(label);
+        }
+
+    private:
+        static constexpr size_t NOT_BOUND = SIZE_MAX;
+
+        std::vector<size_t>                   labels;
+        std::vector<std::pair<size_t, size_t>> fixups;
+
+        uint8_t *grow(size_t count)
+        {
+            bytes.resize(bytes.size() + count);
+            return &bytes[bytes.size() - count];
+        }
+
+        void byte(uint8_t value) { bytes.push_back(value); }
+
+        void dword(int32_t value) { std::memcpy(grow(4), &value, 4); }
+
+        void fixup(size_t label)
+        {
+            fixups.emplace_back(bytes.size(), label);
+            dword(0);
+        }
+
+        void rex(bool wide, Reg reg, Reg base)
+        {
+            uint8_t prefix = 0x40 | wide << 3 | (reg >> 3) << 2 | (base >> 3);
+
+            if(prefix != 0x40)
+                byte(prefix);
+        }
+
+        void memory(Reg reg, Reg base, int32_t disp)
+        {
+            byte(0x80 | (reg & 7) << 3 | (base & 7));
+
+            // rsp and r12 as a base need a sib byte
+            if((base & 7) == RSP)
+                byte(0x24);
+
+            dword(disp);
+        }
+    };
+
+    class Compiler
+    {
+    public:
+        Compiler(const Program& program, Helpers helpers, Stack<Value>& stack)
+        : program(program), helpers(helpers), stack(stack)
+        {}
+
+        // nullptr when the chunk has something this does not handle,
+        // the word then stays interpreted
+        // `self` is the index of the word, a tail call of itself becomes a jump
+        Native compile(const Chunk& chunk, uint32_t self, std::vector<Code>& code)
+        {
+            as = {};
+            this->self = self;
+
+            if(!assign_slots(chunk))
+                return nullptr;
+
+            for(size_t i = 0; i <= chunk.code.size(); i++)
+                as.label();
+
+            epilogue = as.label();
+
+            prologue();
+
+            for(size_t ip = 0; ip < chunk.code.size(); ip++)
+            {
+                as.bind(ip);
+                instruction(chunk, ip);
+            }
+
+            as.bind(chunk.code.size());
+            as.bind(epilogue);
+
+            as.lea(RSP, RBP, -SAVED);
+            as.pop(R15);
+            as.pop(R14);
+            as.pop(R13);
+            as.pop(R12);
+            as.pop(RBX);
+            as.pop(RBP);
+            as.ret();
+
+            if(!as.resolve())
+                return nullptr;
+
+            Code compiled(as.bytes);
+
+            if(!compiled.entry())
+                return nullptr;
+
+            code.push_back(std::move(compiled));
+
+            return code.back().entry();
+        }
+
+    private:
+        // bytes of callee saved registers pushed after rbp
+        static constexpr int32_t SAVED = 40;
+
+        // offsets of the pointers behind Stack::bounds
+        static constexpr int32_t FIRST = 0, LAST = 8, LIMIT = 16;
+
+        static constexpr uint64_t INT_TAG = Value::SMALL_INT_BITS >> 48;
+
+        enum Ext : uint8_t { ADD = 0, OR = 1, AND = 4, SUB = 5, CMP = 7 };
+        enum Shift : uint8_t { SHL = 4, SHR = 5, SAR = 7 };
+
+        const Program& program;
+        Helpers        helpers;
+        Stack<Value>&  stack;
+
+        Assembler as;
+        size_t    epilogue = 0;
+        uint32_t  self     = 0;
+
+        std::vector<int32_t> slot_of;  // frame offset of the loop slot each instruction uses
+        int32_t              frame = 0;
+
+        // do loops nest, the slot of a loop is its depth
+        bool assign_slots(const Chunk& chunk)
+        {
+            const auto& code = chunk.code;
+
+            std::vector<uint32_t> open;  // end of each enclosing loop
+            size_t                depth = 0;
+
+            slot_of.assign(code.size(), 0);
+
+            for(size_t ip = 0; ip < code.size(); ip++)
+            {
+                while(!open.empty() && open.back() <= ip)
+                    open.pop_back();
+
+                switch(code[ip].op)
+                {
+                    case OpCode::DO:
+                    {
+                        if(code[ip].operand <= ip)
+                            return false;
+
+                        slot_of[ip] = slot(open.size());
+                        open.push_back(code[ip].operand);
+                        depth = std::max(depth, open.size());
+                        break;
+                    }
+                    case OpCode::LOOP:
+                    {
+                        uint32_t begin = code[ip].operand - 1;
+
+                        if(code[ip].operand == 0 || begin >= ip || code[begin].op != OpCode::DO)
+                            return false;
+
+                        slot_of[ip] = slot_of[begin];
+                        break;
+                    }
+                    case OpCode::LOOP_INDEX:
+                    {
+                        if(open.empty())
+                            return false;
+
+                        slot_of[ip] = slot(open.size() - 1);
+                        break;
+                    }
+                    default: break;
+                }
+            }
+
+            // the frame below the saved registers keeps rsp 16 byte aligned
+            frame = (int32_t)((sizeof(Slot) * depth + 8 + 15) / 16 * 16 - 8);
+
+            return true;
+        }
+
+        static int32_t slot(size_t depth)
+        {
+            return -(SAVED + (int32_t)sizeof(Slot) * (int32_t)(depth + 1));
+        }
+
+        void prologue()
+        {
+            as.push(RBP);
+            as.mov(RBP, RSP);
+            as.push(RBX);
+            as.push(R12);
+            as.push(R13);
+            as.push(R14);
+            as.push(R15);
+            as.imm(SUB, RSP, frame);
+
+            as.mov(RBX, RDI);
+            as.mov(R13, RSI);
+            as.mov(R12, RDX);
+            as.mov(R14, (uint64_t)stack.bounds());
+        }
+
+        void helper(Helper fn, size_t ip, bool with_slot = false)
+        {
+            as.mov(RDI, RBX);
+            as.mov(RSI, R13);
+            as.mov(RDX, R12);
+            as.mov32(RCX, (uint32_t)ip);
+
+            if(with_slot)
+                as.lea(R8, RBP, slot_of[ip]);
+            else
+                as.mov32(R8, 0);
+
+            as.mov(RAX, (uint64_t)fn);
+            as.call(RAX);
+        }
+
+        // jumps to slow unless reg holds an integer that fits in the payload, clobbers rcx
+        void expect_int(Reg reg, size_t slow)
+        {
+            as.mov(RCX, reg);
+            as.shift(SHR, RCX, 48);
+            as.imm(CMP, RCX, (int32_t)INT_TAG);
+            as.jump(NE, slow);
+        }
+
+        void unbox(Reg reg)
+        {
+            as.shift(SHL, reg, 16);
+            as.shift(SAR, reg, 16);
+        }
+
+        // jumps to slow unless reg fits in the payload, clobbers rcx
+        void expect_small(Reg reg, size_t slow)
+        {
+            as.mov(RCX, reg);
+            as.shift(SHL, RCX, 16);
+            as.shift(SAR, RCX, 16);
+            as.rr(0x39, RCX, reg);
+            as.jump(NE, slow);
+        }
+
+        void box(Reg reg)
+        {
+            as.mov(RCX, Value::PAYLOAD_BITS);
+            as.rr(0x21, reg, RCX);
+            as.mov(RCX, Value::SMALL_INT_BITS);
+            as.rr(0x09, reg, RCX);
+        }
+
+        static bool has_fast_path(OpCode op)
+        {
+            return op == OpCode::ADD || op == OpCode::SUB || op == OpCode::MUL ||
+                   op == OpCode::AND || op == OpCode::OR  ||
+                   (op >= OpCode::EQUAL && op <= OpCode::GREATER_EQUAL);
+        }
+
+        // rdx = rdx op rsi on unboxed integers, boxed again
+        void operate(OpCode op, size_t slow)
+        {
+            switch(op)
+            {
+                case OpCode::ADD: as.rr(0x01, RDX, RSI); expect_small(RDX, slow); break;
+                case OpCode::SUB: as.rr(0x29, RDX, RSI); expect_small(RDX, slow); break;
+                case OpCode::MUL:
+                {
+                    as.imul(RDX, RSI);
+                    as.jump(OVERFLOW, slow);
+                    expect_small(RDX, slow);
+                    break;
+                }
+                case OpCode::AND: as.rr(0x21, RDX, RSI); break;
+                case OpCode::OR:  as.rr(0x09, RDX, RSI); break;
+                default:
+                {
+                    static const Cond conditions[] = { EQ, NE, LT, GT, LE, GE };
+
+                    as.rr(0x39, RDX, RSI);
+                    as.set(conditions[(size_t)op - (size_t)OpCode::EQUAL]);
+                    as.neg(RAX);
+                    as.mov(RDX, RAX);
+                }
+            }
+
+            box(RDX);
+        }
+
+        // the top two cells become `a op b`, with rdx holding the result
+        void binary(OpCode op, size_t slow)
+        {
+            as.load(RAX, R14, LAST);
+            as.mov(RCX, RAX);
+            as.rm(0x2B, RCX, R14, FIRST);
+            as.imm(CMP, RCX, 2 * sizeof(Value));
+            as.jump(LT, slow);
+
+            as.load(RDX, RAX, -16);
+            as.load(RSI, RAX, -8);
+            expect_int(RDX, slow);
+            expect_int(RSI, slow);
+            unbox(RDX);
+            unbox(RSI);
+
+            operate(op, slow);
+
+            // comparisons leave their flag in rax
+            as.load(RAX, R14, LAST);
+            as.store(RAX, -16, RDX);
+            as.imm(SUB, RAX, sizeof(Value));
+            as.store(R14, LAST, RAX);
+        }
+
+        // the top cell becomes `top op constant`
+        void literal(OpCode op, int64_t constant, size_t slow)
+        {
+            as.load(RAX, R14, LAST);
+            as.rm(0x3B, RAX, R14, FIRST);
+            as.jump(EQ, slow);
+
+            as.load(RDX, RAX, -8);
+            expect_int(RDX, slow);
+            unbox(RDX);
+            as.mov(RSI, (uint64_t)constant);
+
+            operate(op, slow);
+
+            as.load(RAX, R14, LAST);
+            as.store(RAX, -8, RDX);
+        }
+
+        // pushes the cell in rdx, jumps to slow when the stack is full
+        void push(size_t slow)
+        {
+            as.load(RAX, R14, LAST);
+            as.rm(0x3B, RAX, R14, LIMIT);
+            as.jump(EQ, slow);
+            as.store(RAX, 0, RDX);
+            as.imm(ADD, RAX, sizeof(Value));
+            as.store(R14, LAST, RAX);
+        }
+
+        static bool small_int(const Value& value)
+        {
+            return (value.raw() >> 48) == INT_TAG;
+        }
+
+        void instruction(const Chunk& chunk, size_t ip)
+        {
+            const Instruction& ins = chunk.code[ip];
+
+            size_t slow = as.label(), done = as.label();
+
+            switch(ins.op)
+            {
+                case OpCode::PUSH:
+                {
+                    const Value& constant = chunk.constants[ins.operand];
+
+                    if(constant.is_object())
+                        break;
+
+                    as.mov(RDX, constant.raw());
+                    push(slow);
+                    as.jump(done);
+                    break;
+                }
+                case OpCode::LITERAL_OP:
+                case OpCode::INCREMENT:
+                case OpCode::DECREMENT:
+                {
+                    OpCode       op       = ins.op == OpCode::INCREMENT ? OpCode::ADD :
+                                            ins.op == OpCode::DECREMENT ? OpCode::SUB : packed_op(ins.operand);
+                    const Value& constant = chunk.constants[ins.index()];
+
+                    if(!has_fast_path(op) || !small_int(constant))
+                        break;
+
+                    literal(op, constant.as_int(), slow);
+                    as.jump(done);
+                    break;
+                }
+                case OpCode::ADD: case OpCode::SUB: case OpCode::MUL:
+                case OpCode::EQUAL: case OpCode::NOT_EQUAL: case OpCode::LESS:
+                case OpCode::GREATER: case OpCode::LESS_EQUAL: case OpCode::GREATER_EQUAL:
+                case OpCode::AND: case OpCode::OR:
+                {
+                    binary(ins.op, slow);
+                    as.jump(done);
+                    as.bind(slow);
+                    helper(helpers.binary, ip);
+                    as.bind(done);
+                    return;
+                }
+                case OpCode::DIV:
+                {
+                    helper(helpers.binary, ip);
+                    return;
+                }
+                case OpCode::CALL_BUILTIN:
+                {
+                    as.mov(RDI, (uint64_t)&stack);
+                    as.mov(RAX, (uint64_t)program.builtins[ins.operand]);
+                    as.call(RAX);
+                    return;
+                }
+                case OpCode::TAIL_CALL:
+                {
+                    // tail calls only come from words without locals, there is nothing to reset
+                    if(ins.operand == self)
+                        return as.jump(0);
+
+                    helper(helpers.call_word, ip);
+                    return;
+                }
+                case OpCode::CALL_WORD:
+                {
+                    helper(helpers.call_word, ip);
+                    return;
+                }
+                case OpCode::JUMP:
+                {
+                    as.jump(ins.operand);
+                    return;
+                }
+                case OpCode::JUMP_IF_FALSE:
+                {
+                    // an empty stack is false
+                    as.load(RAX, R14, LAST);
+                    as.rm(0x3B, RAX, R14, FIRST);
+                    as.jump(EQ, ins.operand);
+
+                    as.load(RDX, RAX, -8);
+                    expect_int(RDX, slow);
+                    as.shift(SHL, RDX, 16);
+                    as.rr(0x85, RDX, RDX);
+                    as.jump(EQ, ins.operand);
+                    as.jump(done);
+
+                    as.bind(slow);
+                    helper(helpers.truthful, ip);
+                    as.test_al();
+                    as.jump(EQ, ins.operand);
+                    as.bind(done);
+                    return;
+                }
+                case OpCode::COMPARE_JUMP:
+                {
+                    binary(packed_op(ins.operand), slow);
+                    as.mov(RCX, Value::SMALL_INT_BITS);
+                    as.rr(0x39, RDX, RCX);
+                    as.jump(EQ, ins.index());
+                    as.jump(done);
+
+                    as.bind(slow);
+                    helper(helpers.compare, ip);
+                    as.test_al();
+                    as.jump(EQ, ins.index());
+                    as.bind(done);
+                    return;
+                }
+                case OpCode::DO:
+                {
+                    helper(helpers.loop_begin, ip, true);
+                    as.test_al();
+                    as.jump(EQ, ins.operand);
+                    return;
+                }
+                case OpCode::LOOP:
+                {
+                    int32_t at = slot_of[ip];
+
+                    as.imm(CMP, RBP, at + offsetof(Slot, real), 0);
+                    as.jump(NE, slow);
+
+                    as.load(RAX, RBP, at + offsetof(Slot, index));
+                    as.imm(ADD, RAX, 1);
+                    as.store(RBP, at + offsetof(Slot, index), RAX);
+                    as.rm(0x3B, RAX, RBP, at + offsetof(Slot, end));
+                    as.jump(LT, ins.operand);
+                    as.jump(done);
+
+                    as.bind(slow);
+                    helper(helpers.loop_next, ip, true);
+                    as.test_al();
+                    as.jump(NE, ins.operand);
+                    as.bind(done);
+                    return;
+                }
+                case OpCode::LOOP_INDEX:
+                {
+                    int32_t at = slot_of[ip];
+
+                    as.imm(CMP, RBP, at + offsetof(Slot, real), 0);
+                    as.jump(NE, slow);
+
+                    as.load(RDX, RBP, at + offsetof(Slot, index));
+                    expect_small(RDX, slow);
+                    box(RDX);
+                    push(slow);
+                    as.jump(done);
+
+                    as.bind(slow);
+                    helper(helpers.loop_index, ip, true);
+                    as.bind(done);
+                    return;
+                }
+                case OpCode::RETURN:
+                {
+                    as.jump(epilogue);
+                    return;
+                }
+                default: break;
+            }
+
+            as.bind(slow);
+            helper(helpers.exec, ip);
+            as.bind(done);
+        }
+    };
+}
+
+#endif
@@ -2,12 +2,15 @@
 
 #include <string>
 #include <string_view>
-#include <map>
+#include <charconv>
+#include <algorithm>
 
 #include "types.hpp"
 #include "log.hpp"
+#include "scan.hpp"
+#include "perfect_hash.hpp"
 
-static const std::map<std::string_view , TokenType> keyword_table =
+static constexpr auto keyword_table = perfect_hash::make<TokenType>(
 {
         {"and",      TokenType::AND},
         {"or",       TokenType::OR},
@@ -21,7 +24,7 @@ static const std::map<std::string_view , TokenType> keyword_table =
         {"until",    TokenType::UNTIL},
         {"variable", TokenType::VARIABLE},
         {"constant", TokenType::CONSTANT}
-};
+});
 
 class Lexer
 {
@@ -29,30 +32,114 @@ class Lexer
 
 public:
 
-    Lexer(std::string& source)
-    : source(std::move(source))
+    // tokens keep views into source, so it has to outlive them
+    Lexer(std::string_view source)
+    : source(source), end(source.size())
+    {
+        source_map.reset(source);
+    }
+
+    // lexes only the tokens that start in [begin, end) of source into its own
+    // symbol table, leaving the line starts to the caller. a speculative lexer
+    // may start inside a string or comment, so errors only mark it as failed
+    Lexer(std::string_view source, size_t begin, size_t end, size_t line, size_t column,
+          SymbolTable& table, bool speculative)
+    : source(source), table(&table), line_starts(nullptr), speculative(speculative),
+      end(end), current(begin), start(begin), line(line), column(column)
     {}
 
     std::vector<Token> scan()
     {
-        tokens.reserve(source.size());
+        tokens.reserve(estimate_tokens());
 
-        while(!at_end())
+        for(;;)
         {
+            skip_whitespace();
+
+            if(at_end() || current >= end)
+                break;
+
+            if(speculative && sync_points.size() < MAX_SYNC_POINTS)
+                sync_points.emplace_back(current, tokens.size());
+
             start = current;
             scan_token();
         }
 
+        if(!line_starts)
+            return std::move(tokens);
+
+        start = current;
         set(END);
 
         return std::move(tokens);
     }
 
+    // yields one token at a time for streaming, END once the source runs out
+    Token next()
+    {
+        tokens.clear();
+
+        while(tokens.empty())
+        {
+            skip_whitespace();
+
+            if(at_end())
+                break;
+
+            start = current;
+            scan_token();
+        }
+
+        if(tokens.empty())
+        {
+            start = current;
+            set(END);
+        }
+
+        return std::move(tokens.back());
+    }
+
+    size_t line_number() const
+    {
+        return line;
+    }
+
+    // where a range lexer stopped, the start of the first token at or after
+    // its end. the next range continues from here
+    size_t stopped_at() const
+    {
+        return current;
+    }
+
+    bool failed() const
+    {
+        return error_found;
+    }
+
+    // offsets a token or comment started at and the number of tokens before
+    // it, for finding where a speculative range agrees with the one before it
+    const std::vector<std::pair<size_t, size_t>>& syncs() const
+    {
+        return sync_points;
+    }
+
 private:
-    const std::string  source;
-    std::vector<Token> tokens;
+    static constexpr size_t MAX_SYNC_POINTS = 1024;
+
+    const std::string_view source;
+    std::vector<Token>     tokens;
+
+    SymbolTable         *table       = &symbols;
+    std::vector<size_t> *line_starts = &source_map.line_starts;
+
+    bool speculative = false;
+    bool error_found = false;
+
+    std::vector<std::pair<size_t, size_t>> sync_points;
 
     size_t
+         end     = 0,
          current = 0,
          start   = 0,
          line    = 1,
@@ -77,7 +164,15 @@ private:
             case '*': set(match_next('!') ? STAR_BANG : STAR);             break;
             case '/': set(match_next('!') ? SLASH_BANG : SLASH);           break;
             case '<': set(match_next('=') ? LESS_EQUAL : LESS_THEN);       break;
-            case '>': set(match_next('=') ? GREATER_EQUAL : GREATER_THEN); break;
+            case '>':
+            {
+                // names like >r start with it
+                if(is_alpha(peek()))
+                    scan_identifier();
+                else
+                    set(match_next('=') ? GREATER_EQUAL : GREATER_THEN);
+                break;
+            }
             case '-':
             {
                 if(is_digit(peek()))
@@ -87,11 +182,12 @@ private:
                 break;
             }
             case '(': scan_comment(); break;
+            case '{': scan_locals(); break;
             case '"': scan_string(); break;
             case ' ':
             case '\t':
             case '\r': return;
-            case '\n': line++; column = 1; return;
+            case '\n': new_line(current); return;
             default:
             {
                 if(is_alpha(c))
@@ -99,25 +195,35 @@ private:
                 else if(is_digit(c))
                     scan_number();
                 else
-                    logger::syntax_error(line, column, c, "invalid token found");
+                    error(c, "invalid token found");
             }
         }
 
         if(!is_terminator(peek()))
-            logger::syntax_error(line, column, peek(), "Token must be terminated");
+            error(peek(), "Token must be terminated");
     }
 
-    void scan_identifier()
+    // blank runs and newlines between tokens are skipped in bulk
+    void skip_whitespace()
     {
-        if(!is_terminator(peek()))
+        for(;;)
         {
-            while(!at_end() && !is_terminator(peek_next()))
-                advance();
-            advance();
+            move_to(scan::skip_blanks(source, current));
+
+            if(peek() != '\n')
+                return;
+
+            current++;
+            new_line(current);
         }
+    }
 
-        std::string text = source.substr(start, current - start);
-        TokenType   type = keyword_table.contains(text) ? keyword_table.at(text) : IDENTIFIER;
+    void scan_identifier()
+    {
+        move_to(scan::find_terminator(source, current));
+
+        std::string_view text = source.substr(start, current - start);
+        TokenType        type = keyword_table.get(text, IDENTIFIER);
 
         if(type == VARIABLE || type == CONSTANT)
             scan_var();
@@ -127,23 +233,20 @@ private:
 
     void scan_var()
     {
-        advance();
+        if(advance() == '\n')
+            new_line(current);
 
         start = current;
 
-        while(!at_end() && !is_terminator(peek_next()))
-            advance();
-
         if(is_terminator(peek()))
-            logger::syntax_error(line, column, ' ', "you must provide an identifier for this variable");
+            error(' ', "you must provide an identifier for this variable");
 
-        advance();
+        move_to(scan::find_terminator(source, current));
     }
 
     void scan_number()
     {
-        loop: while(!at_end() && is_digit(peek()))
-            advance();
+        loop: move_to(scan::skip_digits(source, current));
 
         if(peek() == '.' && is_digit(peek_next()))
         {
@@ -156,8 +259,22 @@ private:
 
     void scan_comment()
     {
-        while(!at_end() && peek() != ')')
-            advance();
+        skip_until(')');
+        advance();
+    }
+
+    // { a b -- } keeps everything between the braces as the lexeme
+    void scan_locals()
+    {
+        start++;
+
+        skip_until('}');
+
+        if(at_end())
+            return error(' ', "locals are not closed");
+
+        set(LOCALS);
+
         advance();
     }
 
@@ -166,18 +283,10 @@ private:
         start++; // moves past the '"' char
         column++;
 
-        while(!at_end() && peek() != '"')
-        {
-            if(peek() == '\n')
-            {
-                column = 1;
-                line++;
-            }
-            advance();
-        }
+        skip_until('"');
 
         if(at_end())
-            return logger::syntax_error(line, column, ' ', "String is not closed");
+            return error(' ', "String is not closed");
 
         set(STRING);
 
@@ -185,6 +294,27 @@ private:
         column++;
     }
 
+    // moves to `close` or the end of the source, counting the newlines passed
+    void skip_until(char close)
+    {
+        for(;;)
+        {
+            move_to(scan::find_either(source, current, close, '\n'));
+
+            if(peek() != '\n')
+                return;
+
+            current++;
+            new_line(current);
+        }
+    }
+
+    inline void move_to(size_t next)
+    {
+        column += next - current;
+        current = next;
+    }
+
     inline char advance()
     {
         if(current >= source.size())
@@ -234,36 +364,112 @@ private:
 
     inline bool is_digit(char c)
     {
-        return (c >= '0' && c <= '9');
+        return scan::is_digit(c);
+    }
+
+    inline bool is_terminator(char c) const
+    {
+        return scan::is_terminator(c);
     }
 
-    inline bool is_terminator(char c)
+    void error(char c, const char *message)
     {
-        return
-           c == '\n'
-        || c == ' '
-        || c == '\r'
-        || c == '\t'
-        || c == '\0';
+        if(!speculative)
+            return logger::syntax_error(line, column, c, message);
+
+        error_found = true;
+        current     = source.size();
     }
 
     inline void set(TokenType type)
     {
-        std::string lexeme = source.substr(start, current-start);
+        std::string_view lexeme = source.substr(start, current-start);
+
+        Token token { type, lexeme, get_value(type, lexeme) };
 
-        Value value { get_value(type, lexeme) };
-        Token token { type, line, column, lexeme, value };
+        if(type == IDENTIFIER || type == VARIABLE || type == CONSTANT)
+            token.symbol = table->intern(token.lexeme);
 
         tokens.emplace_back(std::move(token));
     }
 
-    inline Value get_value(TokenType type, std::string& str)
+    inline Value get_value(TokenType type, std::string_view str)
     {
         switch(type)
         {
-            case NUMBER: return std::stod(str);
-            case STRING: return str;
-            default:     return std::monostate();
+            case NUMBER:
+            {
+                const char *first = str.data(), *last = str.data() + str.size();
+
+                // literals without a fraction are integers unless they overflow 64 bits
+                if(str.find('.') == std::string_view::npos)
+                {
+                    int64_t integer = 0;
+
+                    if(std::from_chars(first, last, integer).ec == std::errc())
+                        return integer;
+                }
+
+                double number = 0;
+                std::from_chars(first, last, number);
+                return number;
+            }
+            case STRING: return std::string(str);
+            default:     return {};
         }
     }
+
+    // `next` is the offset the new line starts at
+    inline void new_line(size_t next)
+    {
+        line++;
+        column = 1;
+
+        if(line_starts)
+            line_starts->push_back(next);
+    }
+
+    // counts the tokens in a sample from where lexing starts and
+    // scales that up, most sources are uniform enough for this
+    size_t estimate_tokens() const
+    {
+        const size_t size   = end - current;
+        const size_t sample = current + std::min<size_t>(size, 64 * 1024);
+
+        size_t count = 0;
+        bool   space = true;
+
+        for(size_t i = current; i < sample; i++)
+        {
+            char c = source[i];
+
+            // comments and strings are skipped whole like scan_token does
+            if(space && (c == '(' || c == '"'))
+            {
+                char close = c == '(' ? ')' : '"';
+
+                while(i + 1 < sample && source[i + 1] != close)
+                    i++;
+
+                count += c == '"';
+                i++;
+                space = false;
+                continue;
+            }
+
+            bool terminator = is_terminator(c);
+
+            if(space && !terminator)
+                count++;
+
+            space = terminator;
+        }
+
+        if(sample == current)
+            return 1;
+
+        double scale = (double)size / (sample - current);
+
+        return count * scale * 1.125 + 1;
+    }
 };
\ No newline at end of file
@@ -4,25 +4,30 @@
 #include <cstdlib>
 
 #include "types.hpp"
+#include "output.hpp"
 
 namespace logger
 {
     template<class ...A>
     void fatal(const char *message, A ...a)
     {
+        output.flush();
+
         std::cerr << "Fatal error: " << message;
         ((std::cerr << a), ...);
         std::exit(-1);
     }
 
     template<class ...A>
-    void syntax_error(Token &token, const char *message, A ...a)
+    void syntax_error(const Token &token, const char *message, A ...a)
     {
+        output.flush();
+
         std::cerr
                 << "["
-                << token.line
+                << token.line()
                 << ':'
-                << token.column
+                << token.column()
                 << "] Syntax error on token '"
                 << token.lexeme
                 << "'\n\tMessage: "
@@ -35,6 +40,8 @@ namespace logger
     template<class ...A>
     void syntax_error(size_t line, size_t column, char c, const char *message, A ...a)
     {
+        output.flush();
+
         std::cerr
                 << "["
                 << line
@@ -50,15 +57,34 @@ namespace logger
         std::exit(-1);
     }
 
+    // a diagnostic that does not stop anything
+    template<class ...A>
+    void note(const Token& token, const char *message, A ...a)
+    {
+        output.flush();
+
+        std::cerr
+            << '['
+            << token.line()
+            << ':'
+            << token.column()
+            << "] Note: "
+            << message;
+        ((std::cerr << a), ...);
+        std::cerr << '\n';
+    }
+
     template<class ...A>
-    void runtime_error(Token& token, const char *message, A ...a)
+    void runtime_error(const Token& token, const char *message, A ...a)
     {
+        output.flush();
+
         std::cerr
             << "\nRuntime Error: "
             << '['
-            << token.line
+            << token.line()
             << ':'
-            << token.column
+            << token.column()
             << ']'
             << "\n\tMessage: "
             << message;
@@ -1,62 +1,200 @@
-#include <iostream>
-#include <fstream>
-#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string_view>
 
 #include "lexer.hpp"
+#include "parallel_lexer.hpp"
 #include "parser.hpp"
+#include "compiler.hpp"
 #include "evaluator.hpp"
 #include "words.hpp"
 #include "log.hpp"
+#include "options.hpp"
+#include "source_file.hpp"
+#include "output.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
+#include "allocations.hpp"
 
-std::string read_file(const char *filename)
+// the global allocation functions report to the allocation profiler. the
+// aligned and array forms keep their defaults, which end up here or pair
+// with each other
+void *operator new(std::size_t size)
 {
-    std::fstream file(filename);
+    void *pointer;
 
-    if (!file.is_open())
-        logger::fatal("invalid filename provided '", filename, "'");
+    while(!(pointer = std::malloc(size ? size : 1)))
+    {
+        std::new_handler handler = std::get_new_handler();
 
-    return {(std::istreambuf_iterator<char>(file)),
-            std::istreambuf_iterator<char>()};
+        if(!handler)
+            throw std::bad_alloc();
+
+        handler();
+    }
+
+    if(allocations.on())
+        allocations.allocated(pointer, size);
+
+    return pointer;
 }
 
-void run(std::string &contents, int argc, char **argv)
+void operator delete(void *pointer) noexcept
 {
-    //auto start = std::chrono::high_resolution_clock::now();
+    if(pointer && allocations.on())
+        allocations.freed(pointer);
 
-    auto tokens = Lexer(contents).scan();
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+    operator delete(pointer);
+}
 
+void run(std::string_view contents, const Options& options)
+{
+    stats.start(Stats::LEX);
+
+    auto tokens = parallel::lex(contents, options.lex_threads);
+
+    stats.stop(Stats::LEX);
+
+    counters.bytes  += contents.size();
+    counters.tokens += tokens.size() - (!tokens.empty() && tokens.back().type == TokenType::END);
+
+    stats.start(Stats::PARSE);
     Parser(tokens, words).parse();
+    stats.stop(Stats::PARSE);
+
+    Program program;
+
+    stats.start(Stats::COMPILE);
+    Compiler(program, words, options).compile(tokens);
+    stats.stop(Stats::COMPILE);
+
+    Evaluator evaluator(program, options);
+
+    stats.start(Stats::EVAL);
+    evaluator.eval();
+    stats.stop(Stats::EVAL);
+}
+
+// lexes one token at a time and runs top level code a line at a time, so
+// words must be defined before they are used. lexing is timed as whatever
+// is not parsing, compiling or evaluating
+void stream(std::string_view contents, const Options& options)
+{
+    counters.bytes += contents.size();
+    Lexer     lexer(contents);
+    Program   program;
+    Compiler  compiler(program, words, options);
+    Evaluator evaluator(program, options);
+
+    std::vector<Token> batch;
+    size_t             batch_line = 0;
+
+    auto flush = [&] ()
+    {
+        if(batch.empty())
+            return;
+
+        stats.stop(Stats::LEX);
+
+        stats.start(Stats::PARSE);
+        Parser(batch, words).parse();
+        stats.stop(Stats::PARSE);
+
+        Chunk chunk;
+
+        stats.start(Stats::COMPILE);
+        compiler.compile_main(batch, chunk);
+        stats.stop(Stats::COMPILE);
 
-    Evaluator(words, tokens, argc, argv).eval();
-
-    //auto end = std::chrono::high_resolution_clock::now();
-
-//    std::cout << "======== words ========\n";
-//
-//    for (auto &[k, v]: words)
-//    {
-//        if(v.index() == 0)
-//            continue;
-//        auto w_tokens = std::get<1>(v);
-//        std::cout << k << '\n';
-//        for (auto &tk: w_tokens)
-//            std::cout << "\t" << tk << '\n';
-//    }
-//
-//    std::cout << "======== tokens ========\n";
-//
-//    for (auto &token: tokens)
-//        std::cout << token << '\n';
-
-    //std::cout << "\nPipeline Time: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start) << '\n';
+        stats.start(Stats::EVAL);
+        evaluator.run_statement(chunk);
+        stats.stop(Stats::EVAL);
+
+        batch.clear();
+
+        stats.start(Stats::LEX);
+    };
+
+    stats.start(Stats::LEX);
+
+    for(;;)
+    {
+        Token token = lexer.next();
+
+        if(token.type == TokenType::END)
+            break;
+
+        counters.tokens++;
+
+        if(token.type == TokenType::COLON)
+        {
+            flush();
+
+            std::vector<Token> definition;
+
+            definition.push_back(std::move(token));
+
+            do
+                definition.push_back(lexer.next());
+            while(definition.back().type != TokenType::SEMI_COLON && definition.back().type != TokenType::END);
+
+            // the colon was counted already
+            counters.tokens += definition.size() - 1 - (definition.back().type == TokenType::END);
+
+            std::string name(definition.size() > 1 ? definition[1].lexeme : "");
+
+            stats.stop(Stats::LEX);
+
+            stats.start(Stats::PARSE);
+            Parser(definition, words).parse();
+            stats.stop(Stats::PARSE);
+
+            stats.start(Stats::COMPILE);
+            compiler.compile_word(name);
+            stats.stop(Stats::COMPILE);
+
+            stats.start(Stats::LEX);
+            continue;
+        }
+
+        if(!batch.empty() && lexer.line_number() != batch_line)
+            flush();
+
+        if(batch.empty())
+            batch_line = lexer.line_number();
+
+        batch.push_back(std::move(token));
+    }
+
+    flush();
+
+    stats.stop(Stats::LEX);
 }
 
 int main(int argc, char **argv)
 {
-    if (argc == 1)
-        logger::fatal("You must provide a valid forth file path");
+    Options options = parse_options(argc, argv);
+
+    output.configure(options.output_buffer, options.output_fd);
+
+    if(options.profile || options.alloc_profile)
+        profiler.start(options.profile);
+
+    if(options.alloc_profile)
+        allocations.start();
+
+    if(options.stats)
+        stats.enable();
 
-    std::string contents = read_file(argv[1]);
+    SourceFile file(options.filename);
 
-    run(contents, argc, argv);
+    if(options.stream)
+        stream(file.view(), options);
+    else
+        run(file.view(), options);
 }
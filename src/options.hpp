@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "log.hpp"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FORTH_COMPUTED_GOTO 1
+#else
+#define FORTH_COMPUTED_GOTO 0
+#endif
+
+// native code is generated for the system v x86-64 calling convention
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(_WIN32)
+#define FORTH_JIT 1
+#else
+#define FORTH_JIT 0
+#endif
+
+enum class Engine
+{
+    SWITCH,   // portable switch dispatch
+    THREADED, // direct threading through labels as values
+};
+
+// superinstruction patterns of the peephole pass, each can be switched off
+enum Peephole : uint32_t
+{
+    LITERAL_OP     = 1 << 0, // a literal followed by a binary operator
+    INCREMENT      = 1 << 1, // 1 + and 1 -
+    DUP_MUL        = 1 << 2, // dup *
+    OVER_OVER      = 1 << 3, // over over
+    COMPARE_BRANCH = 1 << 4, // a comparison followed by if
+    FETCH_STORE    = 1 << 5, // a variable followed by @ or !
+
+    PEEPHOLE_NONE = 0,
+    PEEPHOLE_ALL  = (1 << 6) - 1,
+};
+
+static const std::pair<const char*, Peephole> peephole_names[] =
+{
+    {"literal-op",     LITERAL_OP},
+    {"increment",      INCREMENT},
+    {"dup-mul",        DUP_MUL},
+    {"over-over",      OVER_OVER},
+    {"compare-branch", COMPARE_BRANCH},
+    {"fetch-store",    FETCH_STORE},
+    {"none",           PEEPHOLE_NONE},
+    {"all",            PEEPHOLE_ALL},
+};
+
+struct Options
+{
+    const char *filename = nullptr;
+
+    Engine engine = FORTH_COMPUTED_GOTO ? Engine::THREADED : Engine::SWITCH;
+
+    // slots preallocated for the local variables of every active word call
+    size_t locals_size = 4096;
+
+    // word calls that can be in progress at once
+    size_t return_stack_size = 1 << 20;
+
+    // run top level code as soon as it is lexed instead of after the whole file
+    bool stream = false;
+
+    // threads large sources are lexed on, 0 uses every core
+    size_t lex_threads = 0;
+
+    // peephole patterns applied to every compiled chunk
+    uint32_t peephole = PEEPHOLE_ALL;
+
+    // print what constant folding evaluated and removed to stderr
+    bool fold_report = false;
+
+    // calls after which a word is compiled to native code, 0 never compiles any
+    uint32_t jit_threshold = 0;
+
+    // words with bodies up to this many instructions are copied into their callers, 0 turns it off
+    size_t inline_size = 8;
+
+    // print every call that was or was not inlined to stderr
+    bool inline_log = false;
+
+    // file the collapsed call stacks of a profiled run are written to, null when not profiling
+    const char *profile = nullptr;
+
+    // count the heap blocks of every word and stage and report them at exit
+    bool alloc_profile = false;
+
+    // print the counters of the run to stderr at exit
+    bool stats = false;
+
+    // bytes printed output is gathered in before it is written to output_fd
+    size_t output_buffer = 1 << 20;
+    int    output_fd     = 1;
+
+    // the arguments visible to the script as argc and argv
+    std::vector<char*> args;
+};
+
+size_t option_number(const char *str, const char *arg)
+{
+    char  *end;
+    size_t value = std::strtoull(str, &end, 10);
+
+    if(end == str || *end != '\0')
+        logger::fatal("invalid number in option '", arg, "'");
+
+    return value;
+}
+
+// a comma separated list of pattern names
+uint32_t parse_peephole(const char *list, const char *arg)
+{
+    uint32_t patterns = PEEPHOLE_NONE;
+
+    while(*list)
+    {
+        size_t length = std::strcspn(list, ",");
+        bool   found  = false;
+
+        for(auto &[name, pattern] : peephole_names)
+        {
+            if(std::strlen(name) == length && std::strncmp(name, list, length) == 0)
+            {
+                patterns |= pattern;
+                found     = true;
+            }
+        }
+
+        if(!found)
+            logger::fatal("unknown peephole pattern in option '", arg, "'");
+
+        list += length + (list[length] == ',');
+    }
+
+    return patterns;
+}
+
+static constexpr uint32_t DEFAULT_JIT_THRESHOLD = 100;
+
+// off, on or threshold=N
+uint32_t parse_jit(const char *mode, const char *arg)
+{
+    uint32_t threshold = 0;
+
+    if(std::strcmp(mode, "off") == 0)
+        return 0;
+    else if(std::strcmp(mode, "on") == 0)
+        threshold = DEFAULT_JIT_THRESHOLD;
+    else if(std::strncmp(mode, "threshold=", 10) == 0)
+        threshold = std::clamp<size_t>(option_number(mode + 10, arg), 1, UINT32_MAX);
+    else
+        logger::fatal("unknown jit mode in option '", arg, "'");
+
+    if(!FORTH_JIT)
+        logger::fatal("the jit only supports x86-64 outside of windows");
+
+    return threshold;
+}
+
+// usage: forth [--options] file [script arguments]
+Options parse_options(int argc, char **argv)
+{
+    Options options;
+
+    options.args.push_back(argv[0]);
+
+    int i = 1;
+
+    for(; i < argc && std::strncmp(argv[i], "--", 2) == 0; i++)
+    {
+        const char *arg = argv[i];
+
+        if(std::strcmp(arg, "--engine=switch") == 0)
+            options.engine = Engine::SWITCH;
+        else if(std::strcmp(arg, "--engine=threaded") == 0)
+        {
+            if(!FORTH_COMPUTED_GOTO)
+                logger::fatal("the threaded engine is not supported by this compiler");
+            options.engine = Engine::THREADED;
+        }
+        else if(std::strcmp(arg, "--stream") == 0)
+            options.stream = true;
+        else if(std::strncmp(arg, "--jit=", 6) == 0)
+            options.jit_threshold = parse_jit(arg + 6, arg);
+        else if(std::strncmp(arg, "--profile=", 10) == 0)
+            options.profile = arg + 10;
+        else if(std::strcmp(arg, "--alloc-profile") == 0)
+            options.alloc_profile = true;
+        else if(std::strcmp(arg, "--stats") == 0)
+            options.stats = true;
+        else if(std::strcmp(arg, "--fold-report") == 0)
+            options.fold_report = true;
+        else if(std::strcmp(arg, "--inline-log") == 0)
+            options.inline_log = true;
+        else if(std::strncmp(arg, "--inline=", 9) == 0)
+            options.inline_size = option_number(arg + 9, arg);
+        else if(std::strncmp(arg, "--locals=", 9) == 0)
+            options.locals_size = option_number(arg + 9, arg);
+        else if(std::strncmp(arg, "--return-stack=", 15) == 0)
+            options.return_stack_size = option_number(arg + 15, arg);
+        else if(std::strncmp(arg, "--lex-threads=", 14) == 0)
+            options.lex_threads = option_number(arg + 14, arg);
+        else if(std::strncmp(arg, "--peephole=", 11) == 0)
+            options.peephole = parse_peephole(arg + 11, arg);
+        else if(std::strncmp(arg, "--output-buffer=", 16) == 0)
+            options.output_buffer = option_number(arg + 16, arg);
+        else if(std::strncmp(arg, "--output-fd=", 12) == 0)
+            options.output_fd = option_number(arg + 12, arg);
+        else
+            logger::fatal("unknown option '", arg, "'");
+    }
+
+    if(i == argc)
+        logger::fatal("You must provide a valid forth file path");
+
+    options.filename = argv[i];
+
+    // the profiler has to see every call, inlined and native words hide theirs
+    if(options.profile || options.alloc_profile)
+    {
+        options.inline_size   = 0;
+        options.jit_threshold = 0;
+    }
+
+    if(options.lex_threads == 0)
+        options.lex_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for(; i < argc; i++)
+        options.args.push_back(argv[i]);
+
+    return options;
+}
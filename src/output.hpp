@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// everything the program prints goes through here. it is only written out
+// when the buffer fills up, on flush, before reading a key or reporting an
+// error, and at exit
+class Output
+{
+public:
+    static constexpr size_t DEFAULT_SIZE = 1 << 20;
+
+    Output()
+    {
+        buffer.resize(DEFAULT_SIZE);
+    }
+
+    ~Output()
+    {
+        flush();
+    }
+
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+
+    // a size of 0 writes everything as soon as it is printed
+    void configure(size_t size, int descriptor)
+    {
+        flush();
+        buffer.resize(size);
+        fd = descriptor;
+    }
+
+    void write(std::string_view text)
+    {
+        if(text.size() > buffer.size() - used)
+        {
+            flush();
+
+            if(text.size() > buffer.size())
+                return write_out(text.data(), text.size());
+        }
+
+        std::memcpy(buffer.data() + used, text.data(), text.size());
+        used += text.size();
+    }
+
+    void put(char c)
+    {
+        if(used == buffer.size())
+        {
+            flush();
+
+            if(buffer.empty())
+                return write_out(&c, 1);
+        }
+
+        buffer[used++] = c;
+    }
+
+    void integer(int64_t value)
+    {
+        char text[24];
+        auto result = std::to_chars(text, text + sizeof(text), value);
+        write({text, size_t(result.ptr - text)});
+    }
+
+    // the same text `std::cout << value` gives with its default precision of 6
+    void number(double value)
+    {
+        char text[32];
+        auto result = std::to_chars(text, text + sizeof(text), value, std::chars_format::general, 6);
+        write({text, size_t(result.ptr - text)});
+    }
+
+    void flush()
+    {
+        write_out(buffer.data(), used);
+        used = 0;
+    }
+
+private:
+    std::vector<char> buffer;
+    size_t            used = 0;
+    int               fd   = 1;
+
+    void write_out(const char *data, size_t size)
+    {
+        while(size > 0)
+        {
+#ifdef _WIN32
+            int written = _write(fd, data, (unsigned)size);
+#else
+            ssize_t written = ::write(fd, data, size);
+#endif
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written <= 0)
+                return;
+
+            data += written;
+            size -= written;
+        }
+    }
+};
+
+static Output output;
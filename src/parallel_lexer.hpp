@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "lexer.hpp"
+#include "scan.hpp"
+
+// lexes a large source on several threads and gives exactly the tokens,
+// symbol ids and line starts Lexer::scan would.
+//
+// the source is cut at newlines without knowing if they are inside a string
+// or comment, and every range is lexed as if it was not. the ranges are then
+// stitched in order: a range is used from the first token it starts at the
+// same offset the range before it stopped at, since from there it is in the
+// same state the sequential lexer would be. a range that never agrees, or hit
+// an error, is lexed again from that offset
+namespace parallel
+{
+    // sources smaller than this are not worth the threads
+    static constexpr size_t MIN_RANGE_SIZE = 256 * 1024;
+
+    // workers pull indexes off a shared counter until there are none left
+    template<typename F>
+    void for_each(size_t count, size_t threads, F f)
+    {
+        std::atomic<size_t> next{0};
+
+        auto worker = [&] ()
+        {
+            for(size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;)
+                f(i);
+        };
+
+        std::vector<std::thread> pool;
+
+        for(size_t t = 1; t < std::min(threads, count); t++)
+            pool.emplace_back(worker);
+
+        worker();
+
+        for(auto& thread : pool)
+            thread.join();
+    }
+
+    struct Range
+    {
+        size_t begin = 0, end = 0;
+
+        SymbolTable        table;
+        std::vector<Token> tokens;
+
+        size_t first   = 0; // tokens before this were lexed from the wrong state
+        size_t stopped = 0;
+
+        bool failed = false;
+
+        std::vector<std::pair<size_t, size_t>> syncs;
+
+        void lex(std::string_view source, size_t from, bool speculative)
+        {
+            const auto& line_starts = source_map.line_starts;
+
+            size_t line = std::upper_bound(line_starts.begin(), line_starts.end(), from) - line_starts.begin();
+
+            Lexer lexer(source, from, end, line, from - line_starts[line - 1] + 1, table, speculative);
+
+            tokens  = lexer.scan();
+            stopped = lexer.stopped_at();
+            failed  = lexer.failed();
+            syncs   = lexer.syncs();
+        }
+    };
+
+    // every newline starts a line whatever it is inside of, so these are
+    // found without lexing
+    inline void find_line_starts(std::string_view source, size_t threads)
+    {
+        size_t count = std::max<size_t>(1, std::min(threads * 4, source.size() / MIN_RANGE_SIZE));
+
+        std::vector<std::vector<size_t>> starts(count);
+
+        for_each(count, threads, [&] (size_t i)
+        {
+            size_t at  = source.size() * i / count;
+            size_t end = source.size() * (i + 1) / count;
+
+            while((at = scan::find_either(source.substr(0, end), at, '\n', '\n')) < end)
+                starts[i].push_back(++at);
+        });
+
+        for(auto& part : starts)
+            source_map.line_starts.insert(source_map.line_starts.end(), part.begin(), part.end());
+    }
+
+    inline std::vector<Token> lex(std::string_view source, size_t threads)
+    {
+        if(threads <= 1 || source.size() < 2 * MIN_RANGE_SIZE)
+            return Lexer(source).scan();
+
+        source_map.reset(source);
+
+        find_line_starts(source, threads);
+
+        const auto& line_starts = source_map.line_starts;
+
+        // ranges begin on the first line start after an even split
+        size_t count = std::min(threads * 4, source.size() / MIN_RANGE_SIZE);
+
+        std::vector<size_t> begins{0};
+
+        for(size_t i = 1; i < count; i++)
+        {
+            auto begin = std::lower_bound(line_starts.begin(), line_starts.end(), source.size() * i / count);
+
+            if(begin != line_starts.end() && *begin > begins.back() && *begin < source.size())
+                begins.push_back(*begin);
+        }
+
+        std::vector<Range> ranges(begins.size());
+
+        for(size_t i = 0; i < ranges.size(); i++)
+        {
+            ranges[i].begin = begins[i];
+            ranges[i].end   = i + 1 < begins.size() ? begins[i + 1] : source.size();
+        }
+
+        // even the first range is speculative, errors are only reported once
+        // the workers are done, by the range lexed again in order
+        for_each(ranges.size(), threads, [&] (size_t i)
+        {
+            ranges[i].lex(source, ranges[i].begin, true);
+        });
+
+        // where the sequential lexer would start its next token
+        size_t at = 0;
+
+        for(Range& range : ranges)
+        {
+            if(at >= range.end)
+            {
+                // everything in here belongs to a token from an earlier range
+                range.tokens.clear();
+                range.table = {};
+                continue;
+            }
+
+            auto sync = std::lower_bound(range.syncs.begin(), range.syncs.end(), std::pair<size_t, size_t>(at, 0));
+
+            if(!range.failed && sync != range.syncs.end() && sync->first == at)
+                range.first = sync->second;
+            else
+            {
+                range.table = {};
+                range.lex(source, at, false);
+                range.first = 0;
+            }
+
+            at = range.stopped;
+        }
+
+        // ids are handed out in the order names are first seen, like the
+        // sequential lexer does
+        std::vector<std::vector<uint32_t>> ids(ranges.size());
+        std::vector<size_t>                offsets(ranges.size() + 1, 0);
+
+        for(size_t i = 0; i < ranges.size(); i++)
+        {
+            Range& range = ranges[i];
+
+            ids[i].assign(range.table.size(), NO_SYMBOL);
+
+            if(range.first == 0)
+            {
+                for(uint32_t id = 0; id < range.table.size(); id++)
+                    ids[i][id] = symbols.intern(range.table.name(id));
+            }
+            else
+            {
+                for(size_t t = range.first; t < range.tokens.size(); t++)
+                {
+                    uint32_t symbol = range.tokens[t].symbol;
+
+                    if(symbol != NO_SYMBOL && ids[i][symbol] == NO_SYMBOL)
+                        ids[i][symbol] = symbols.intern(range.table.name(symbol));
+                }
+            }
+
+            offsets[i + 1] = offsets[i] + range.tokens.size() - range.first;
+        }
+
+        std::vector<Token> tokens(offsets.back() + 1);
+
+        for_each(ranges.size(), threads, [&] (size_t i)
+        {
+            Range& range = ranges[i];
+
+            for(size_t t = range.first; t < range.tokens.size(); t++)
+            {
+                Token& token = range.tokens[t];
+
+                if(token.symbol != NO_SYMBOL)
+                    token.symbol = ids[i][token.symbol];
+
+                tokens[offsets[i] + t - range.first] = std::move(token);
+            }
+
+            range.tokens = {};
+        });
+
+        tokens.back() = Token(TokenType::END, source.substr(source.size()));
+
+        return tokens;
+    }
+}
@@ -60,13 +60,14 @@ private:
         if(current_tk.type != IDENTIFIER)
             logger::syntax_error(current_tk, "expected identifier");
 
-        std::string word_name = std::move(current_tk.lexeme);
+        std::string word_name(current_tk.lexeme);
 
-        if(words.contains(word_name))
+        if(words.contains(word_name) || builtin_table.contains(word_name))
             logger::syntax_error(current_tk, "word has been previously defined or is reserved");
 
+        // control flow inside the body is checked by the compiler
         while(!at_end() && peek().type != SEMI_COLON)
-            eval();
+            advance();
 
         if(peek().type != SEMI_COLON)
             logger::syntax_error(peek(), "unterminated word");
@@ -85,37 +86,6 @@ private:
         current++;
     }
 
-    void eval()
-    {
-        Token& token = advance();
-
-        bool ok = true, had_if = false;
-
-        switch(token.type)
-        {
-            case IF:    ok = scan_until(THEN); had_if = true;  break;
-            case ELSE:  ok = had_if;           had_if = false; break;
-            case DO:    ok = scan_until(LOOP);  break;
-            case BEGIN: ok = scan_until(UNTIL); break;
-            case THEN:
-            case LOOP:
-            case UNTIL: ok = false; break;
-        }
-
-        if(!ok)
-            logger::syntax_error(token, "invalid expression");
-    }
-
-    inline bool scan_until(TokenType type)
-    {
-        while(!at_end() && peek().type != type)
-            current++;
-
-        current++;
-
-        return peek().type != type;
-    }
-
     inline Token& peek()
     {
         if(at_end())
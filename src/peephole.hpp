@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "options.hpp"
+#include "words.hpp"
+
+// fuses pairs of instructions that show up together in most programs into
+// one superinstruction, saving a dispatch and a round trip through the stack.
+// a pair is only fused when it came from two tokens in a row, so errors can
+// still point at either of them, and when nothing jumps to its second half
+namespace peephole
+{
+    inline bool is_binary(OpCode op)
+    {
+        return op >= OpCode::ADD && op <= OpCode::OR;
+    }
+
+    inline bool is_comparison(OpCode op)
+    {
+        return op >= OpCode::EQUAL && op <= OpCode::GREATER_EQUAL;
+    }
+
+    inline bool calls(const Program& program, const Instruction& ins, builtin_fn fn)
+    {
+        return ins.op == OpCode::CALL_BUILTIN && program.builtins[ins.operand] == fn;
+    }
+
+    // the superinstruction for `a` followed by `b`, an op of RETURN when there is none
+    inline Instruction fuse(const Chunk& chunk, const Program& program, uint32_t patterns,
+                            const Instruction& a, const Instruction& b)
+    {
+        const Instruction none{OpCode::RETURN, 0};
+
+        if(a.op == OpCode::PUSH && is_binary(b.op))
+        {
+            const Value& constant = chunk.constants[a.operand];
+
+            if(!constant.is_number())
+                return none;
+
+            bool one = constant.is_int() && constant.as_int() == 1;
+
+            if(patterns & INCREMENT && one && b.op == OpCode::ADD)
+                return {OpCode::INCREMENT, a.operand};
+            if(patterns & INCREMENT && one && b.op == OpCode::SUB)
+                return {OpCode::DECREMENT, a.operand};
+            if(patterns & LITERAL_OP && a.operand <= PACKED_MASK)
+                return {OpCode::LITERAL_OP, pack(b.op, a.operand)};
+
+            return none;
+        }
+
+        if(patterns & DUP_MUL && calls(program, a, duplicate) && b.op == OpCode::MUL)
+            return {OpCode::DUP_MUL, 0};
+
+        if(patterns & OVER_OVER && calls(program, a, over) && calls(program, b, over))
+            return {OpCode::OVER_OVER, 0};
+
+        if(patterns & COMPARE_BRANCH && is_comparison(a.op) && b.op == OpCode::JUMP_IF_FALSE && b.operand <= PACKED_MASK)
+            return {OpCode::COMPARE_JUMP, pack(a.op, b.operand)};
+
+        if(patterns & FETCH_STORE)
+        {
+            if(a.op == OpCode::GLOBAL_REF && b.op == OpCode::FETCH) return {OpCode::FETCH_GLOBAL, a.operand};
+            if(a.op == OpCode::LOCAL_REF  && b.op == OpCode::FETCH) return {OpCode::FETCH_LOCAL,  a.operand};
+            if(a.op == OpCode::GLOBAL_REF && b.op == OpCode::STORE) return {OpCode::STORE_GLOBAL, a.operand};
+            if(a.op == OpCode::LOCAL_REF  && b.op == OpCode::STORE) return {OpCode::STORE_LOCAL,  a.operand};
+        }
+
+        return none;
+    }
+
+    inline void optimize(Chunk& chunk, const Program& program, uint32_t patterns)
+    {
+        if(patterns == PEEPHOLE_NONE)
+            return;
+
+        const std::vector<Instruction>& code = chunk.code;
+
+        std::vector<bool> targets(code.size() + 1, false);
+
+        for(const Instruction& ins : code)
+        {
+            if(is_jump(ins.op))
+                targets[ins.index()] = true;
+        }
+
+        std::vector<Instruction> fused;
+        std::vector<uint32_t>    token_of;
+        std::vector<uint32_t>    moved(code.size() + 1);  // old index to new index
+
+        fused.reserve(code.size());
+        token_of.reserve(code.size());
+
+        for(size_t i = 0; i < code.size(); i++)
+        {
+            moved[i] = fused.size();
+
+            if(i + 1 < code.size() && !targets[i + 1] && chunk.token_of[i + 1] == chunk.token_of[i] + 1)
+            {
+                Instruction ins = fuse(chunk, program, patterns, code[i], code[i + 1]);
+
+                if(ins.op != OpCode::RETURN)
+                {
+                    fused.push_back(ins);
+                    token_of.push_back(chunk.token_of[i]);
+
+                    // nothing jumps to the second half, it maps to the fused one
+                    moved[++i] = fused.size() - 1;
+                    continue;
+                }
+            }
+
+            fused.push_back(code[i]);
+            token_of.push_back(chunk.token_of[i]);
+        }
+
+        moved[code.size()] = fused.size();
+
+        for(Instruction& ins : fused)
+        {
+            if(is_jump(ins.op))
+                ins.set_index(moved[ins.index()]);
+        }
+
+        chunk.code     = std::move(fused);
+        chunk.token_of = std::move(token_of);
+    }
+}
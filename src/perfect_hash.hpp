@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// tables of names that are fixed at compile time. the seed of the hash is
+// searched for while compiling until every name lands in its own slot, so a
+// lookup is one hash and one compare, and the table is plain constant data
+namespace perfect_hash
+{
+    template<typename V>
+    struct Entry
+    {
+        std::string_view name;
+        V                value{};
+    };
+
+    constexpr uint64_t hash(std::string_view str, uint64_t seed)
+    {
+        uint64_t h = 0xcbf29ce484222325 ^ (seed * 0x9e3779b97f4a7c15);
+
+        for(char c : str)
+        {
+            h ^= (uint8_t)c;
+            h *= 0x100000001b3;
+        }
+
+        return h ^ (h >> 32);
+    }
+
+    template<typename V, size_t N>
+    class Table
+    {
+    public:
+        static constexpr size_t SIZE = std::bit_ceil(N * 2);
+
+        std::array<Entry<V>, N>    entries{};
+        std::array<Entry<V>, SIZE> slots{};
+        uint64_t                   seed = 0;
+
+        constexpr const V *find(std::string_view name) const
+        {
+            const Entry<V>& slot = slots[hash(name, seed) & (SIZE - 1)];
+
+            return !slot.name.empty() && slot.name == name ? &slot.value : nullptr;
+        }
+
+        constexpr V get(std::string_view name, V fallback) const
+        {
+            const V *value = find(name);
+            return value ? *value : fallback;
+        }
+
+        constexpr bool contains(std::string_view name) const
+        {
+            return find(name) != nullptr;
+        }
+
+        constexpr auto begin() const { return entries.begin(); }
+        constexpr auto end()   const { return entries.end(); }
+    };
+
+    template<typename V, size_t N>
+    consteval Table<V, N> make(const Entry<V> (&entries)[N])
+    {
+        Table<V, N> table;
+
+        for(size_t i = 0; i < N; i++)
+            table.entries[i] = entries[i];
+
+        for(;; table.seed++)
+        {
+            table.slots = {};
+
+            bool collided = false;
+
+            for(const Entry<V>& entry : entries)
+            {
+                Entry<V>& slot = table.slots[hash(entry.name, table.seed) & (table.SIZE - 1)];
+
+                if(!slot.name.empty())
+                {
+                    collided = true;
+                    break;
+                }
+
+                slot = entry;
+            }
+
+            if(!collided)
+                return table;
+        }
+    }
+}
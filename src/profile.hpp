@@ -0,0 +1,351 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define FORTH_TSC 1
+#else
+#define FORTH_TSC 0
+#endif
+
+#include "log.hpp"
+#include "output.hpp"
+
+// counts the calls and time of every word and builtin on a calling context
+// tree, one node for each distinct chain of calls from the top level. a call
+// only pays for two clock reads and finding its node among the children of
+// its caller, the flat report and the caller to callee edges are summed up
+// from the tree when the program ends
+class Profiler
+{
+public:
+    // functions are numbered so words and builtins can share one table
+    static constexpr uint32_t TOP_LEVEL = 0;
+    static constexpr uint32_t NONE      = UINT32_MAX;  // nothing is running
+
+    static uint32_t word(uint32_t index)    { return 1 + 2 * index; }
+    static uint32_t builtin(uint32_t index) { return 2 + 2 * index; }
+
+    Profiler() = default;
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // a static, so the report is also written when an error ends the program
+    // through std::exit. calls still running then are closed at that point
+    ~Profiler()
+    {
+        report();
+    }
+
+    // collapsed stacks go to path, the flat report to stderr. without a path
+    // calls are only followed so current() knows what is running
+    void start(const char *path)
+    {
+        if(path)
+        {
+            folded = std::fopen(path, "w");
+
+            if(!folded)
+                logger::fatal("cannot open profile output '", path, "'");
+        }
+
+        nodes.push_back({NO_NODE, NO_NODE});
+        names.assign(1, "(top level)");
+
+        start_ticks = now();
+        start_time  = std::chrono::steady_clock::now();
+    }
+
+    // the function of the innermost call
+    uint32_t current() const
+    {
+        return active.empty() ? NONE : nodes[active.back().node].function;
+    }
+
+    std::string_view name_of(uint32_t function) const
+    {
+        return named(function) ? std::string_view(names[function]) : "?";
+    }
+
+    bool named(uint32_t function) const
+    {
+        return function < names.size() && !names[function].empty();
+    }
+
+    void name(uint32_t function, std::string_view name)
+    {
+        if(function >= names.size())
+            names.resize(function + 1);
+
+        names[function] = name;
+    }
+
+    void enter(uint32_t function)
+    {
+        uint32_t parent = active.empty() ? ROOT : active.back().node;
+
+        // direct recursion stays on one node, so it does not grow the tree
+        if(parent != ROOT && nodes[parent].function == function)
+        {
+            nodes[parent].recursive++;
+            active.push_back({parent, now(), 0, true});
+            return;
+        }
+
+        uint32_t node = child(parent, function);
+
+        nodes[node].calls++;
+        active.push_back({node, now(), 0, false});
+    }
+
+    void leave()
+    {
+        uint64_t end   = now();
+        Active   call  = active.back();
+        uint64_t spent = end - call.start;
+
+        active.pop_back();
+
+        Node& node = nodes[call.node];
+
+        node.self += spent - call.children;
+
+        // a merged recursive call is already inside the time of the outer one
+        if(!call.merged)
+            node.total += spent;
+
+        if(!active.empty())
+            active.back().children += spent;
+    }
+
+private:
+    static constexpr uint32_t ROOT    = 0;
+    static constexpr uint32_t NO_NODE = UINT32_MAX;
+
+    struct Node
+    {
+        uint32_t function, parent;
+        uint32_t child   = NO_NODE;  // first child
+        uint32_t sibling = NO_NODE;  // next child of the parent
+
+        uint64_t calls = 0, recursive = 0;
+        uint64_t self  = 0, total     = 0;  // in ticks
+    };
+
+    // a call that has not returned yet
+    struct Active
+    {
+        uint32_t node;
+        uint64_t start, children;
+        bool     merged;
+    };
+
+    struct Totals
+    {
+        uint64_t calls = 0, self = 0, total = 0;
+    };
+
+    std::vector<Node>        nodes;
+    std::vector<Active>      active;
+    std::vector<std::string> names;
+
+    std::FILE *folded = nullptr;
+
+    uint64_t                              start_ticks = 0;
+    std::chrono::steady_clock::time_point start_time;
+
+    static uint64_t now()
+    {
+#if FORTH_TSC
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // the node for function under parent, a child that is found moves to
+    // the front so the hot ones are found first
+    uint32_t child(uint32_t parent, uint32_t function)
+    {
+        uint32_t previous = NO_NODE;
+
+        for(uint32_t at = nodes[parent].child; at != NO_NODE; previous = at, at = nodes[at].sibling)
+        {
+            if(nodes[at].function != function)
+                continue;
+
+            if(previous != NO_NODE)
+            {
+                nodes[previous].sibling = nodes[at].sibling;
+                nodes[at].sibling       = nodes[parent].child;
+                nodes[parent].child     = at;
+            }
+
+            return at;
+        }
+
+        nodes.push_back({function, parent});
+        nodes.back().sibling = nodes[parent].child;
+        nodes[parent].child  = nodes.size() - 1;
+
+        return nodes.size() - 1;
+    }
+
+    void report()
+    {
+        // calls still running when the program exits end here
+        while(!active.empty())
+            leave();
+
+        if(!folded)
+            return;
+
+        // the report comes after everything the program printed
+        output.flush();
+
+        double ns_per_tick = 1;
+
+#if FORTH_TSC
+        uint64_t ticks = now() - start_ticks;
+        double   ns    = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time).count();
+
+        if(ticks)
+            ns_per_tick = ns / ticks;
+#endif
+
+        std::vector<Totals>                                 flat(names.size());
+        std::map<std::pair<uint32_t, uint32_t>, Totals>     edges;
+        std::vector<uint32_t>                               on_path(names.size(), 0);
+        std::string                                         path;
+
+        // walks the tree depth first, keeping how often each function is on
+        // the path so time inside a recursive call is only counted once
+        struct Step
+        {
+            uint32_t node;
+            size_t   length;  // of the path before the node
+            bool     done;    // all children were walked
+        };
+
+        std::vector<Step> walk;
+
+        for(uint32_t at = nodes[ROOT].child; at != NO_NODE; at = nodes[at].sibling)
+            walk.push_back({at, 0, false});
+
+        while(!walk.empty())
+        {
+            Step step = walk.back();
+            walk.pop_back();
+
+            const Node& node = nodes[step.node];
+
+            if(step.done)
+            {
+                on_path[node.function]--;
+                continue;
+            }
+
+            Totals& sum = flat[node.function];
+
+            sum.calls += node.calls + node.recursive;
+            sum.self  += node.self;
+
+            if(on_path[node.function] == 0)
+                sum.total += node.total;
+
+            if(node.parent != ROOT)
+            {
+                Totals& edge = edges[{nodes[node.parent].function, node.function}];
+
+                edge.calls += node.calls;
+                edge.total += node.total;
+            }
+
+            if(node.recursive)
+                edges[{node.function, node.function}].calls += node.recursive;
+
+            path.resize(step.length);
+
+            if(step.length)
+                path += ';';
+
+            for(char c : name_of(node.function))
+                path += c == ';' ? '_' : c;
+
+            if(node.self)
+                std::fprintf(folded, "%s %llu\n", path.c_str(), (unsigned long long)(node.self * ns_per_tick));
+
+            on_path[node.function]++;
+            walk.push_back({step.node, 0, true});
+
+            for(uint32_t child = node.child; child != NO_NODE; child = nodes[child].sibling)
+                walk.push_back({child, path.size(), false});
+        }
+
+        std::fclose(folded);
+        folded = nullptr;
+
+        print(flat, edges, ns_per_tick);
+    }
+
+    void print(const std::vector<Totals>& flat, const std::map<std::pair<uint32_t, uint32_t>, Totals>& edges, double ns_per_tick)
+    {
+        double ms  = ns_per_tick / 1e6;
+        double run = flat[TOP_LEVEL].total * ms;
+
+        auto percent = [&] (uint64_t ticks) { return run > 0 ? ticks * ms / run * 100 : 0.0; };
+
+        std::vector<uint32_t> order;
+
+        for(uint32_t function = 0; function < flat.size(); function++)
+        {
+            if(flat[function].calls)
+                order.push_back(function);
+        }
+
+        std::sort(order.begin(), order.end(), [&] (uint32_t a, uint32_t b) { return flat[a].self > flat[b].self; });
+
+        std::fprintf(stderr, "\nprofile, %.3f ms\n\n", run);
+        std::fprintf(stderr, "%12s %12s %7s %12s %7s  %s\n", "calls", "self ms", "self%", "total ms", "total%", "name");
+
+        for(uint32_t function : order)
+        {
+            const Totals& sum = flat[function];
+
+            std::fprintf(stderr, "%12llu %12.3f %6.1f%% %12.3f %6.1f%%  %.*s\n",
+                         (unsigned long long)sum.calls, sum.self * ms, percent(sum.self),
+                         sum.total * ms, percent(sum.total), (int)name_of(function).size(), name_of(function).data());
+        }
+
+        std::vector<std::pair<std::pair<uint32_t, uint32_t>, Totals>> calls(edges.begin(), edges.end());
+
+        std::sort(calls.begin(), calls.end(), [] (auto& a, auto& b) { return a.second.total > b.second.total; });
+
+        std::fprintf(stderr, "\n%12s %12s  %s\n", "calls", "total ms", "caller -> callee");
+
+        for(auto &[edge, sum] : calls)
+        {
+            std::string_view caller = name_of(edge.first), callee = name_of(edge.second);
+
+            std::fprintf(stderr, "%12llu %12.3f  %.*s -> %.*s\n", (unsigned long long)sum.calls, sum.total * ms,
+                         (int)caller.size(), caller.data(), (int)callee.size(), callee.data());
+        }
+    }
+};
+
+static Profiler profiler;
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "simd.hpp"
+
+// byte scanners the lexer skips runs of source with. every scanner takes the
+// offset to start at and returns the offset of the first byte that stops it,
+// or the source size. sse2 classifies 16 bytes at a time and is inlined for the
+// short runs (blanks, identifiers, numbers), the long runs inside strings and
+// comments go through the widest set the cpu has
+namespace scan
+{
+    inline bool is_blank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline bool is_terminator(char c)
+    {
+        return is_blank(c) || c == '\n' || c == '\0';
+    }
+
+    inline bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    namespace scalar
+    {
+        inline size_t find_either(const char *data, size_t i, size_t size, char a, char b)
+        {
+            while(i < size && data[i] != a && data[i] != b)
+                i++;
+            return i;
+        }
+    }
+
+#if FORTH_X86
+    inline unsigned first_bit(uint32_t mask)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    namespace sse2
+    {
+        inline __m128i equal(__m128i bytes, char c)
+        {
+            return _mm_cmpeq_epi8(bytes, _mm_set1_epi8(c));
+        }
+
+        inline __m128i blanks(__m128i bytes)
+        {
+            return _mm_or_si128(_mm_or_si128(equal(bytes, ' '), equal(bytes, '\t')), equal(bytes, '\r'));
+        }
+
+        inline __m128i terminators(__m128i bytes)
+        {
+            return _mm_or_si128(blanks(bytes), _mm_or_si128(equal(bytes, '\n'), equal(bytes, '\0')));
+        }
+
+        // bytes - '0' as unsigned is below 10 only for digits
+        inline __m128i digits(__m128i bytes)
+        {
+            __m128i offset = _mm_sub_epi8(bytes, _mm_set1_epi8('0'));
+            return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(9)), offset);
+        }
+
+        // moves `i` to the first byte classify matches, or does not match when
+        // stop_on_match is false. leaves `i` at the tail shorter than 16 bytes
+        // and returns false when there is none in the whole blocks
+        template<bool stop_on_match, typename Classify>
+        inline bool find(const char *data, size_t& i, size_t size, Classify classify)
+        {
+            for(; i + 16 <= size; i += 16)
+            {
+                __m128i  bytes = _mm_loadu_si128((const __m128i*)(data + i));
+                uint32_t mask  = _mm_movemask_epi8(classify(bytes));
+
+                if(!stop_on_match)
+                    mask ^= 0xFFFF;
+
+                if(mask)
+                {
+                    i += first_bit(mask);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        inline size_t find_either(const char *data, size_t i, size_t size, char a, char b)
+        {
+            const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+
+            for(; i + 16 <= size; i += 16)
+            {
+                __m128i  bytes = _mm_loadu_si128((const __m128i*)(data + i));
+                uint32_t mask  = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, va), _mm_cmpeq_epi8(bytes, vb)));
+
+                if(mask)
+                    return i + first_bit(mask);
+            }
+
+            return scalar::find_either(data, i, size, a, b);
+        }
+    }
+
+    namespace avx2
+    {
+        FORTH_TARGET_AVX2 inline size_t find_either(const char *data, size_t i, size_t size, char a, char b)
+        {
+            const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+
+            for(; i + 32 <= size; i += 32)
+            {
+                __m256i  bytes = _mm256_loadu_si256((const __m256i*)(data + i));
+                uint32_t mask  = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, va), _mm256_cmpeq_epi8(bytes, vb)));
+
+                if(mask)
+                    return i + first_bit(mask);
+            }
+
+            return scalar::find_either(data, i, size, a, b);
+        }
+    }
+#endif
+
+    using find_either_kernel = size_t(*)(const char *data, size_t i, size_t size, char a, char b);
+
+    inline find_either_kernel find_either_impl()
+    {
+#if FORTH_X86
+        static const find_either_kernel selected = simd::has_avx2() ? avx2::find_either : sse2::find_either;
+        return selected;
+#else
+        return scalar::find_either;
+#endif
+    }
+
+    // first byte that is not a space, tab or carriage return
+    inline size_t skip_blanks(std::string_view source, size_t i)
+    {
+#if FORTH_X86
+        if(sse2::find<false>(source.data(), i, source.size(), sse2::blanks))
+            return i;
+#endif
+        while(i < source.size() && is_blank(source[i]))
+            i++;
+        return i;
+    }
+
+    // end of an identifier, the first whitespace or nul byte
+    inline size_t find_terminator(std::string_view source, size_t i)
+    {
+#if FORTH_X86
+        if(sse2::find<true>(source.data(), i, source.size(), sse2::terminators))
+            return i;
+#endif
+        while(i < source.size() && !is_terminator(source[i]))
+            i++;
+        return i;
+    }
+
+    inline size_t skip_digits(std::string_view source, size_t i)
+    {
+#if FORTH_X86
+        if(sse2::find<false>(source.data(), i, source.size(), sse2::digits))
+            return i;
+#endif
+        while(i < source.size() && is_digit(source[i]))
+            i++;
+        return i;
+    }
+
+    // first `a` or `b`, used for the end of strings and comments and the newlines inside them
+    inline size_t find_either(std::string_view source, size_t i, char a, char b)
+    {
+        return find_either_impl()(source.data(), i, source.size(), a, b);
+    }
+}
@@ -0,0 +1,428 @@
+#pragma once
+
+#include <cstddef>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FORTH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define FORTH_X86 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FORTH_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define FORTH_TARGET_AVX2
+#endif
+
+// kernels over dense double arrays. sse2 is always there on x86-64, avx2 is
+// picked at runtime and everything else falls back to plain loops
+namespace simd
+{
+    enum Op
+    {
+        ADD, SUB, MUL, DIV, LESS, GREATER, EQUAL, OP_COUNT,
+    };
+
+    using binary_kernel    = void(*)(const double *a, const double *b, double *out, size_t n);
+    using broadcast_kernel = void(*)(const double *a, double b, double *out, size_t n);
+    using reduce_kernel    = double(*)(const double *a, size_t n);
+    using dot_kernel       = double(*)(const double *a, const double *b, size_t n);
+
+    struct Kernels
+    {
+        const char *name;
+
+        binary_kernel    binary[OP_COUNT];
+        broadcast_kernel broadcast[OP_COUNT];       // array op scalar
+        broadcast_kernel broadcast_left[OP_COUNT];  // scalar op array, still called array first
+
+        reduce_kernel sum, min, max;
+        dot_kernel    dot;
+    };
+
+    // comparisons give -1 for true and 0 for false like the comparison words
+    template<Op op>
+    inline double apply(double a, double b)
+    {
+        switch(op)
+        {
+            case ADD:     return a + b;
+            case SUB:     return a - b;
+            case MUL:     return a * b;
+            case DIV:     return a / b;
+            case LESS:    return a < b  ? -1 : 0;
+            case GREATER: return a > b  ? -1 : 0;
+            case EQUAL:   return a == b ? -1 : 0;
+        }
+        return 0;
+    }
+
+    namespace scalar
+    {
+        template<Op op>
+        void binary(const double *a, const double *b, double *out, size_t n)
+        {
+            for(size_t i = 0; i < n; i++)
+                out[i] = apply<op>(a[i], b[i]);
+        }
+
+        template<Op op>
+        void broadcast(const double *a, double b, double *out, size_t n)
+        {
+            for(size_t i = 0; i < n; i++)
+                out[i] = apply<op>(a[i], b);
+        }
+
+        template<Op op>
+        void broadcast_left(const double *b, double a, double *out, size_t n)
+        {
+            for(size_t i = 0; i < n; i++)
+                out[i] = apply<op>(a, b[i]);
+        }
+
+        inline double sum(const double *a, size_t n)
+        {
+            double total = 0;
+            for(size_t i = 0; i < n; i++)
+                total += a[i];
+            return total;
+        }
+
+        inline double min(const double *a, size_t n)
+        {
+            double out = std::numeric_limits<double>::infinity();
+            for(size_t i = 0; i < n; i++)
+                out = a[i] < out ? a[i] : out;
+            return out;
+        }
+
+        inline double max(const double *a, size_t n)
+        {
+            double out = -std::numeric_limits<double>::infinity();
+            for(size_t i = 0; i < n; i++)
+                out = a[i] > out ? a[i] : out;
+            return out;
+        }
+
+        inline double dot(const double *a, const double *b, size_t n)
+        {
+            double total = 0;
+            for(size_t i = 0; i < n; i++)
+                total += a[i] * b[i];
+            return total;
+        }
+    }
+
+#if FORTH_X86
+    namespace sse2
+    {
+        template<Op op>
+        inline __m128d apply(__m128d a, __m128d b)
+        {
+            const __m128d truth = _mm_set1_pd(-1.0);
+
+            switch(op)
+            {
+                case ADD:     return _mm_add_pd(a, b);
+                case SUB:     return _mm_sub_pd(a, b);
+                case MUL:     return _mm_mul_pd(a, b);
+                case DIV:     return _mm_div_pd(a, b);
+                case LESS:    return _mm_and_pd(_mm_cmplt_pd(a, b), truth);
+                case GREATER: return _mm_and_pd(_mm_cmpgt_pd(a, b), truth);
+                case EQUAL:   return _mm_and_pd(_mm_cmpeq_pd(a, b), truth);
+            }
+            return a;
+        }
+
+        template<Op op>
+        void binary(const double *a, const double *b, double *out, size_t n)
+        {
+            size_t i = 0;
+
+            for(; i + 2 <= n; i += 2)
+                _mm_storeu_pd(out + i, apply<op>(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+
+            scalar::binary<op>(a + i, b + i, out + i, n - i);
+        }
+
+        template<Op op>
+        void broadcast(const double *a, double b, double *out, size_t n)
+        {
+            const __m128d vb = _mm_set1_pd(b);
+
+            size_t i = 0;
+
+            for(; i + 2 <= n; i += 2)
+                _mm_storeu_pd(out + i, apply<op>(_mm_loadu_pd(a + i), vb));
+
+            scalar::broadcast<op>(a + i, b, out + i, n - i);
+        }
+
+        template<Op op>
+        void broadcast_left(const double *b, double a, double *out, size_t n)
+        {
+            const __m128d va = _mm_set1_pd(a);
+
+            size_t i = 0;
+
+            for(; i + 2 <= n; i += 2)
+                _mm_storeu_pd(out + i, apply<op>(va, _mm_loadu_pd(b + i)));
+
+            scalar::broadcast_left<op>(b + i, a, out + i, n - i);
+        }
+
+        inline double horizontal(__m128d v, double (*fold)(double, double))
+        {
+            double lanes[2];
+            _mm_storeu_pd(lanes, v);
+            return fold(lanes[0], lanes[1]);
+        }
+
+        inline double sum(const double *a, size_t n)
+        {
+            __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+
+            size_t i = 0;
+
+            for(; i + 4 <= n; i += 4)
+            {
+                acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+                acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+            }
+
+            double total = horizontal(_mm_add_pd(acc0, acc1), [] (double x, double y) { return x + y; });
+
+            return total + scalar::sum(a + i, n - i);
+        }
+
+        inline double min(const double *a, size_t n)
+        {
+            __m128d acc = _mm_set1_pd(std::numeric_limits<double>::infinity());
+
+            size_t i = 0;
+
+            for(; i + 2 <= n; i += 2)
+                acc = _mm_min_pd(acc, _mm_loadu_pd(a + i));
+
+            double out  = horizontal(acc, [] (double x, double y) { return x < y ? x : y; });
+            double tail = scalar::min(a + i, n - i);
+
+            return tail < out ? tail : out;
+        }
+
+        inline double max(const double *a, size_t n)
+        {
+            __m128d acc = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+
+            size_t i = 0;
+
+            for(; i + 2 <= n; i += 2)
+                acc = _mm_max_pd(acc, _mm_loadu_pd(a + i));
+
+            double out  = horizontal(acc, [] (double x, double y) { return x > y ? x : y; });
+            double tail = scalar::max(a + i, n - i);
+
+            return tail > out ? tail : out;
+        }
+
+        inline double dot(const double *a, const double *b, size_t n)
+        {
+            __m128d acc = _mm_setzero_pd();
+
+            size_t i = 0;
+
+            for(; i + 2 <= n; i += 2)
+                acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+
+            double total = horizontal(acc, [] (double x, double y) { return x + y; });
+
+            return total + scalar::dot(a + i, b + i, n - i);
+        }
+    }
+
+    namespace avx2
+    {
+        template<Op op>
+        FORTH_TARGET_AVX2 inline __m256d apply(__m256d a, __m256d b)
+        {
+            const __m256d truth = _mm256_set1_pd(-1.0);
+
+            switch(op)
+            {
+                case ADD:     return _mm256_add_pd(a, b);
+                case SUB:     return _mm256_sub_pd(a, b);
+                case MUL:     return _mm256_mul_pd(a, b);
+                case DIV:     return _mm256_div_pd(a, b);
+                case LESS:    return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ), truth);
+                case GREATER: return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_GT_OQ), truth);
+                case EQUAL:   return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ), truth);
+            }
+            return a;
+        }
+
+        template<Op op>
+        FORTH_TARGET_AVX2 void binary(const double *a, const double *b, double *out, size_t n)
+        {
+            size_t i = 0;
+
+            for(; i + 4 <= n; i += 4)
+                _mm256_storeu_pd(out + i, apply<op>(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+
+            scalar::binary<op>(a + i, b + i, out + i, n - i);
+        }
+
+        template<Op op>
+        FORTH_TARGET_AVX2 void broadcast(const double *a, double b, double *out, size_t n)
+        {
+            const __m256d vb = _mm256_set1_pd(b);
+
+            size_t i = 0;
+
+            for(; i + 4 <= n; i += 4)
+                _mm256_storeu_pd(out + i, apply<op>(_mm256_loadu_pd(a + i), vb));
+
+            scalar::broadcast<op>(a + i, b, out + i, n - i);
+        }
+
+        template<Op op>
+        FORTH_TARGET_AVX2 void broadcast_left(const double *b, double a, double *out, size_t n)
+        {
+            const __m256d va = _mm256_set1_pd(a);
+
+            size_t i = 0;
+
+            for(; i + 4 <= n; i += 4)
+                _mm256_storeu_pd(out + i, apply<op>(va, _mm256_loadu_pd(b + i)));
+
+            scalar::broadcast_left<op>(b + i, a, out + i, n - i);
+        }
+
+        FORTH_TARGET_AVX2 inline double horizontal(__m256d v, double (*fold)(double, double))
+        {
+            double lanes[4];
+            _mm256_storeu_pd(lanes, v);
+            return fold(fold(lanes[0], lanes[1]), fold(lanes[2], lanes[3]));
+        }
+
+        FORTH_TARGET_AVX2 inline double sum(const double *a, size_t n)
+        {
+            __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+
+            size_t i = 0;
+
+            for(; i + 8 <= n; i += 8)
+            {
+                acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+                acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+            }
+
+            double total = horizontal(_mm256_add_pd(acc0, acc1), [] (double x, double y) { return x + y; });
+
+            return total + scalar::sum(a + i, n - i);
+        }
+
+        FORTH_TARGET_AVX2 inline double min(const double *a, size_t n)
+        {
+            __m256d acc = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+
+            size_t i = 0;
+
+            for(; i + 4 <= n; i += 4)
+                acc = _mm256_min_pd(acc, _mm256_loadu_pd(a + i));
+
+            double out  = horizontal(acc, [] (double x, double y) { return x < y ? x : y; });
+            double tail = scalar::min(a + i, n - i);
+
+            return tail < out ? tail : out;
+        }
+
+        FORTH_TARGET_AVX2 inline double max(const double *a, size_t n)
+        {
+            __m256d acc = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+
+            size_t i = 0;
+
+            for(; i + 4 <= n; i += 4)
+                acc = _mm256_max_pd(acc, _mm256_loadu_pd(a + i));
+
+            double out  = horizontal(acc, [] (double x, double y) { return x > y ? x : y; });
+            double tail = scalar::max(a + i, n - i);
+
+            return tail > out ? tail : out;
+        }
+
+        FORTH_TARGET_AVX2 inline double dot(const double *a, const double *b, size_t n)
+        {
+            __m256d acc = _mm256_setzero_pd();
+
+            size_t i = 0;
+
+            for(; i + 4 <= n; i += 4)
+                acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+
+            double total = horizontal(acc, [] (double x, double y) { return x + y; });
+
+            return total + scalar::dot(a + i, b + i, n - i);
+        }
+    }
+
+    inline bool has_avx2()
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+        int info[4];
+
+        __cpuid(info, 1);
+
+        bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+
+        __cpuidex(info, 7, 0);
+
+        return os_saves_ymm && (info[1] & (1 << 5));
+#else
+        return false;
+#endif
+    }
+#endif
+
+#define FORTH_KERNEL_TABLE(isa)                                                                      \
+    {                                                                                                \
+        #isa,                                                                                        \
+        {isa::binary<ADD>, isa::binary<SUB>, isa::binary<MUL>, isa::binary<DIV>,                     \
+         isa::binary<LESS>, isa::binary<GREATER>, isa::binary<EQUAL>},                               \
+        {isa::broadcast<ADD>, isa::broadcast<SUB>, isa::broadcast<MUL>, isa::broadcast<DIV>,         \
+         isa::broadcast<LESS>, isa::broadcast<GREATER>, isa::broadcast<EQUAL>},                      \
+        {isa::broadcast_left<ADD>, isa::broadcast_left<SUB>, isa::broadcast_left<MUL>,               \
+         isa::broadcast_left<DIV>, isa::broadcast_left<LESS>, isa::broadcast_left<GREATER>,          \
+         isa::broadcast_left<EQUAL>},                                                                \
+        isa::sum, isa::min, isa::max, isa::dot,                                                      \
+    }
+
+    // the widest kernel set the cpu supports, picked on first use
+    inline const Kernels& kernels()
+    {
+        static const Kernels scalar_kernels = FORTH_KERNEL_TABLE(scalar);
+
+#if FORTH_X86
+        static const Kernels sse2_kernels = FORTH_KERNEL_TABLE(sse2);
+        static const Kernels avx2_kernels = FORTH_KERNEL_TABLE(avx2);
+
+        static const Kernels& selected = has_avx2() ? avx2_kernels : sse2_kernels;
+
+        (void)scalar_kernels;
+
+        return selected;
+#else
+        return scalar_kernels;
+#endif
+    }
+
+#undef FORTH_KERNEL_TABLE
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "log.hpp"
+
+// maps a source file read only into memory instead of copying it onto the
+// heap, the pages are only read in as the lexer reaches them.
+// windows.h declares a TokenType of its own, so there the file is read instead
+class SourceFile
+{
+public:
+    explicit SourceFile(const char *filename)
+    {
+#ifdef _WIN32
+        std::FILE *file = std::fopen(filename, "rb");
+
+        if(!file)
+            logger::fatal("invalid filename provided '", filename, "'");
+
+        char   chunk[64 * 1024];
+        size_t read;
+
+        while((read = std::fread(chunk, 1, sizeof(chunk), file)) != 0)
+            buffer.append(chunk, read);
+
+        std::fclose(file);
+
+        data = buffer.data();
+        size = buffer.size();
+#else
+        fd = open(filename, O_RDONLY);
+
+        if(fd < 0)
+            logger::fatal("invalid filename provided '", filename, "'");
+
+        struct stat info{};
+
+        if(fstat(fd, &info) != 0)
+            logger::fatal("could not read the size of '", filename, "'");
+
+        size = info.st_size;
+
+        if(size == 0)
+            return;
+
+        void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if(address == MAP_FAILED)
+            logger::fatal("could not map '", filename, "'");
+
+        madvise(address, size, MADV_SEQUENTIAL);
+
+        data   = (const char*)address;
+        mapped = true;
+#endif
+    }
+
+    ~SourceFile()
+    {
+#ifndef _WIN32
+        if(mapped)
+            munmap((void*)data, size);
+        if(fd >= 0)
+            close(fd);
+#endif
+    }
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    std::string_view view() const
+    {
+        return {data ? data : "", size};
+    }
+
+private:
+    const char *data = nullptr;
+    size_t      size = 0;
+
+#ifdef _WIN32
+    std::string buffer;
+#else
+    int  fd     = -1;
+    bool mapped = false;
+#endif
+};
@@ -1,150 +1,217 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <memory>
+#include <new>
+#include <vector>
+#include <utility>
 #include <stdexcept>
 
+// contiguous data stack, index 0 is the bottom of the stack.
+// the storage is kept as three pointers, in the order bounds() hands them
+// out, so native code can push and pop cells without calling back in
 template<class T>
 class Stack
 {
-    struct Node
-    {
-        T     data;
-        Node *last;
-        Node *next;
-    };
-
 public:
-    Stack() : head(nullptr), tail(nullptr), length(0) {}
+    static constexpr size_t DEFAULT_CAPACITY = 1024;
+
+    explicit Stack(size_t capacity = DEFAULT_CAPACITY)
+    {
+        reserve(capacity);
+    }
 
     ~Stack()
     {
-        if(!length)
-            return;
+        std::destroy(first, last);
+        ::operator delete(first);
+    }
 
-        Node *node = head;
+    Stack(const Stack&) = delete;
+    Stack& operator=(const Stack&) = delete;
 
-        while(node)
+    // item may be a cell of this stack, so it is taken before growing
+    void push(const T& item)
+    {
+        if(last == limit)
         {
-            Node *next = node->next;
-            delete node;
-            node = next;
+            T copy(item);
+            grow();
+            ::new(last) T(std::move(copy));
         }
+        else
+            ::new(last) T(item);
+
+        if(++last > high)
+            high = last;
     }
 
-    void push(T item)
+    void push(T&& item)
     {
-        Node *node = new Node{item, tail, nullptr};
-
-        if(!head)
-            head = node;
-        if(!tail)
-            tail = node;
-
-        tail->next = node;
-        tail       = node;
+        if(last == limit)
+        {
+            T moved(std::move(item));
+            grow();
+            ::new(last) T(std::move(moved));
+        }
+        else
+            ::new(last) T(std::move(item));
 
-        length++;
+        if(++last > high)
+            high = last;
     }
 
     void pop()
     {
-        Node *temp = tail;
-
-        tail = tail->last;
-
-        delete temp;
+        (--last)->~T();
+    }
 
-        if(tail)
-            tail->next = nullptr;
+    void pop_n(size_t amount)
+    {
+        if(amount > len())
+            return;
 
-        length--;
+        std::destroy(last - amount, last);
+        last -= amount;
     }
 
-    void pop_n(size_t amount)
+    // reverses the top n items where they are
+    void reverse_top(size_t amount)
     {
-        if(amount > length)
+        if(amount > len())
             return;
 
-        for(size_t i = 0; i < amount; i++)
-            pop();
+        std::reverse(last - amount, last);
     }
 
     T& back()
     {
-        if(tail == nullptr)
+        if(empty())
             throw std::out_of_range("back of stack is empty");
-        return tail->data;
+        return last[-1];
     }
 
     T& front()
     {
-        if(head == nullptr)
+        if(empty())
             throw std::out_of_range("front of stack is empty");
-        return head->data;
+        return first[0];
+    }
+
+    // depth 0 is the top of the stack
+    T& peek(size_t depth)
+    {
+        return last[-1 - (ptrdiff_t)depth];
+    }
+
+    T& operator[](size_t index)
+    {
+        return first[index];
     }
 
     inline bool empty() const
     {
-        return length == 0;
+        return last == first;
     }
 
     size_t len() const
     {
-        return length;
+        return last - first;
+    }
+
+    // the most items the stack has held, pushes from native code are not seen
+    size_t peak() const
+    {
+        return high - first;
+    }
+
+    size_t capacity() const
+    {
+        return limit - first;
+    }
+
+    void reserve(size_t capacity)
+    {
+        if(capacity > this->capacity())
+            reallocate(capacity);
+    }
+
+    // the first, last and limit pointers, one after the other
+    T **bounds()
+    {
+        return &first;
     }
 
+    // returns the top n items with the top of the stack last
     template<size_t n>
     std::array<T, n> get_array_from_back(bool auto_pop = false)
     {
-        if(!tail || n > length)
+        if(n == 0 || n > len())
             return {};
 
         std::array<T, n> output{};
 
-        Node *node = tail;
+        T *from = last - n;
 
-        for(size_t i = n; node && i != 0; i--)
-        {
-            output[i-1] = node->data;
-            node = node->last;
+        for(size_t i = 0; i < n; i++)
+            output[i] = auto_pop ? std::move(from[i]) : from[i];
 
-            if(auto_pop)
-                pop();
-        }
+        if(auto_pop)
+            pop_n(n);
 
         return output;
     }
 
+    // returns the top n items with the top of the stack first
     std::vector<T> get_vec_from_back(size_t n, bool auto_pop = false)
     {
-        if(!tail || n > length)
+        if(n == 0 || n > len())
             return {};
 
         std::vector<T> output;
 
         output.reserve(n);
 
-        Node *node = tail;
+        T *top = last - 1;
 
-        for(size_t i = n-1; node && i >= 0; i--)
-        {
-            output.push_back(node->data);
-            node = node->last;
+        for(size_t i = 0; i < n; i++)
+            output.push_back(auto_pop ? std::move(*(top - i)) : *(top - i));
 
-            if(auto_pop)
-                pop();
-        }
+        if(auto_pop)
+            pop_n(n);
 
         return output;
     }
 
     std::pair<T&, T&> top_two()
     {
-        return {tail->last->data, tail->data};
+        return {last[-2], last[-1]};
     }
 
 private:
-    Node *head;
-    Node *tail;
-    size_t length;
-};
\ No newline at end of file
+    T *first = nullptr;
+    T *last  = nullptr;
+    T *limit = nullptr;
+    T *high  = nullptr;  // the deepest last has been
+
+    void grow()
+    {
+        reallocate(std::max<size_t>(capacity() * 2, 16));
+    }
+
+    void reallocate(size_t capacity)
+    {
+        T     *data = (T*)::operator new(capacity * sizeof(T));
+        size_t size = len();
+
+        std::uninitialized_move(first, last, data);
+        std::destroy(first, last);
+        ::operator delete(first);
+
+        high  = data + (high - first);
+        first = data;
+        last  = data + size;
+        limit = data + capacity;
+    }
+};
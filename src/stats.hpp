@@ -0,0 +1,146 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+#include "output.hpp"
+
+// counters bumped all over the pipeline. they are plain integers of the
+// thread that bumps them, so counting is a single increment and they are
+// always on, --stats only decides whether they are printed at exit
+struct Counters
+{
+    uint64_t bytes    = 0;  // source lexed
+    uint64_t tokens   = 0;  // produced by the lexer
+    uint64_t words    = 0;  // defined by the program
+    uint64_t executed = 0;  // instructions the interpreter dispatched
+    uint64_t copies   = 0;  // of string and array values
+    uint64_t lookups  = 0;  // variables read, written or referenced
+};
+
+static thread_local Counters counters;
+
+// wall time of every stage and the report of the counters, what the `stats`
+// word prints and what --stats prints to stderr at exit
+class Stats
+{
+public:
+    enum Stage { LEX, PARSE, COMPILE, EVAL, STAGES };
+
+    // the deepest the data stack has been, set while an evaluator is alive
+    std::function<size_t()> stack_peak;
+
+    Stats() = default;
+
+    Stats(const Stats&) = delete;
+    Stats& operator=(const Stats&) = delete;
+
+    // prints the counters to stderr when --stats asked for them
+    ~Stats()
+    {
+        if(!enabled)
+            return;
+
+        output.flush();
+
+        std::string text = report();
+        std::fprintf(stderr, "\n%s", text.c_str());
+    }
+
+    void enable()
+    {
+        enabled = true;
+    }
+
+    void start(Stage stage)
+    {
+        started[stage] = clock::now();
+        running[stage] = true;
+    }
+
+    void stop(Stage stage)
+    {
+        if(!running[stage])
+            return;
+
+        spent[stage] += clock::now() - started[stage];
+        running[stage] = false;
+    }
+
+    static const char *name(Stage stage)
+    {
+        static const char *names[] = {"lex", "parse", "compile", "eval", "other"};
+        return names[stage];
+    }
+
+    // the stage running now, STAGES between them
+    Stage stage() const
+    {
+        for(int stage = 0; stage < STAGES; stage++)
+        {
+            if(running[stage])
+                return (Stage)stage;
+        }
+
+        return STAGES;
+    }
+
+    // a stage that is still running counts up to now
+    double seconds(Stage stage) const
+    {
+        clock::duration time = spent[stage];
+
+        if(running[stage])
+            time += clock::now() - started[stage];
+
+        return std::chrono::duration<double>(time).count();
+    }
+
+    std::string report() const
+    {
+        std::string text;
+        char        line[128];
+
+        double eval = seconds(EVAL);
+
+        auto add = [&] (const char *label, uint64_t value)
+        {
+            std::snprintf(line, sizeof(line), "%-22s %14llu\n", label, (unsigned long long)value);
+            text += line;
+        };
+
+        add("bytes lexed", counters.bytes);
+        add("tokens", counters.tokens);
+        add("words defined", counters.words);
+        add("instructions run", counters.executed);
+
+        std::snprintf(line, sizeof(line), "%-22s %14.0f\n", "instructions/s", eval > 0 ? counters.executed / eval : 0.0);
+        text += line;
+
+        add("peak stack depth", stack_peak ? stack_peak() : 0);
+        add("string/array copies", counters.copies);
+        add("variable lookups", counters.lookups);
+
+        for(int stage = 0; stage < STAGES; stage++)
+        {
+            std::snprintf(line, sizeof(line), "%-22s %14.3f\n", (std::string(name((Stage)stage)) + " ms").c_str(), seconds((Stage)stage) * 1e3);
+            text += line;
+        }
+
+        return text;
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    bool enabled = false;
+
+    clock::time_point started[STAGES] = {};
+    clock::duration   spent[STAGES]   = {};
+    bool              running[STAGES] = {};
+};
+
+static Stats stats;
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+static constexpr uint32_t NO_SYMBOL = UINT32_MAX;
+
+// interns identifiers into dense integer ids so nothing after the lexer
+// has to compare names
+class SymbolTable
+{
+    struct Hash
+    {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view str) const
+        {
+            return std::hash<std::string_view>{}(str);
+        }
+    };
+
+public:
+    uint32_t intern(std::string_view name)
+    {
+        auto it = ids.find(name);
+
+        if(it != ids.end())
+            return it->second;
+
+        uint32_t id = names.size();
+
+        names.emplace_back(name);
+        ids.emplace(names.back(), id);
+
+        return id;
+    }
+
+    // returns NO_SYMBOL when the name was never interned
+    uint32_t find(std::string_view name) const
+    {
+        auto it = ids.find(name);
+        return it != ids.end() ? it->second : NO_SYMBOL;
+    }
+
+    const std::string& name(uint32_t id) const
+    {
+        return names[id];
+    }
+
+    size_t size() const
+    {
+        return names.size();
+    }
+
+private:
+    std::vector<std::string>                                         names;
+    std::unordered_map<std::string, uint32_t, Hash, std::equal_to<>> ids;
+};
+
+static SymbolTable symbols;
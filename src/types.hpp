@@ -1,9 +1,14 @@
 #pragma once
 
+#include <algorithm>
 #include <sstream>
-#include <variant>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "symbols.hpp"
+#include "value.hpp"
+
 enum class TokenType
 {
     NUMBER, STRING, ARRAY, IDENTIFIER,
@@ -20,7 +25,7 @@ enum class TokenType
 
     AND, OR, INVERT, IF, THEN, ELSE,
 
-    DO, LOOP, BEGIN, UNTIL, VARIABLE, CONSTANT,
+    DO, LOOP, BEGIN, UNTIL, LOCALS, VARIABLE, CONSTANT,
 
     END,
 };
@@ -34,36 +39,50 @@ static const char *TK_type_str[] =
         "Equal", "Bang equal", "Question", "At", "Bang",
         "Plus bang", "Minus bang", "Star bang", "slash bang",
         "And", "Or", "Invert", "If", "Then", "Else",
-        "Do", "Loop", "Begin", "Until", "Variable", "Constant",
+        "Do", "Loop", "Begin", "Until", "Locals", "Variable", "Constant",
         "End",
 };
 
-class Token;
 
-using Array = std::vector<std::variant<double, std::string>>;
-using Value = std::variant<std::monostate, double, std::string, Array, Token*>;
+// line starts of the source being run, tokens only keep a view into the source
+// so their position is looked up here when a diagnostic needs it
+struct SourceMap
+{
+    std::string_view    source;
+    std::vector<size_t> line_starts{0};
+
+    void reset(std::string_view text)
+    {
+        source = text;
+        line_starts.assign(1, 0);
+    }
+
+    // returns {0, 0} for text that is not part of the source
+    std::pair<size_t, size_t> locate(const char *at) const
+    {
+        if(!at || at < source.data() || at > source.data() + source.size())
+            return {0, 0};
+
+        size_t offset = at - source.data();
+        auto   line   = std::upper_bound(line_starts.begin(), line_starts.end(), offset) - 1;
+
+        return {line - line_starts.begin() + 1, offset - *line + 1};
+    }
+};
+
+static SourceMap source_map;
 
 class Token
 {
 public:
 
     Token()
-            : type(TokenType::END), line(0), column(0) {}
+            : type(TokenType::END) {}
 
-    Token(TokenType type, size_t line, size_t column, std::string &lexeme)
+    Token(TokenType type, std::string_view lexeme, Value value = {})
             :
             type(type),
-            line(line),
-            column(column),
-            lexeme(std::move(lexeme)),
-            value(std::monostate()) {}
-
-    Token(TokenType type, size_t line, size_t column, std::string &lexeme, Value &value)
-            :
-            type(type),
-            line(line),
-            column(column),
-            lexeme(std::move(lexeme)),
+            lexeme(lexeme),
             value(std::move(value)) {}
 
     Token(TokenType type, Value value)
@@ -71,6 +90,16 @@ public:
             type(type),
             value(std::move(value)) {}
 
+    size_t line() const
+    {
+        return source_map.locate(lexeme.data()).first;
+    }
+
+    size_t column() const
+    {
+        return source_map.locate(lexeme.data()).second;
+    }
+
     std::string to_str() const
     {
         std::stringstream ss;
@@ -79,15 +108,19 @@ public:
 
         ss <<
            "Type(" << type_str << ") " <<
-           "Position(" << line << ':' << column << ") " <<
+           "Position(" << line() << ':' << column() << ") " <<
            "Lexeme(" << lexeme << ") " <<
            "Value(";
 
-        switch (value.index())
+        switch (value.type())
         {
-            case 0: ss << "None"; break;
-            case 1: ss << std::get<double>(value); break;
-            case 2: ss << std::get<std::string>(value); break;
+            case ValueType::NONE:   ss << "None"; break;
+            case ValueType::NUMBER: ss << value.as_number(); break;
+            case ValueType::INTEGER: ss << value.as_int(); break;
+            case ValueType::STRING: ss << value.as_string(); break;
+            case ValueType::ARRAY:    ss << "Array"; break;
+            case ValueType::VARIABLE: ss << "Variable"; break;
+            case ValueType::NUMBERS:  ss << "Numbers"; break;
         }
 
         ss << ")";
@@ -102,8 +135,7 @@ public:
     }
 
     TokenType type;
-    size_t line;
-    size_t column;
-    std::string lexeme;
+    uint32_t symbol = NO_SYMBOL; // interned lexeme of identifiers and variable names
+    std::string_view lexeme;     // view into the source, see SourceMap
     Value value;
 };
\ No newline at end of file
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "stats.hpp"
+
+class Token;
+class Value;
+
+using Array   = std::vector<Value>;
+using Numbers = std::vector<double>;
+
+enum class ValueType : uint8_t
+{
+    NONE, NUMBER, STRING, ARRAY, VARIABLE, NUMBERS, INTEGER,
+};
+
+// a single 8 byte stack cell. doubles are stored as they are, every other type
+// lives in the payload of a negative quiet NaN with its tag in bits 48 to 50:
+//
+//   1111 1111 1111 1ttt  pppp ... pppp
+//                   tag  48 bit payload
+//
+// tags with bit 2 set point at a reference counted Object. objects are shared
+// between copies and only copied when a shared one is about to be mutated.
+//
+// integers are 64 bit and wrap around. the ones that fit in 48 bits live in
+// the payload, the rest are boxed, both integer tags end in 0b11
+class Value
+{
+    static_assert(sizeof(void*) == 8, "nan boxing needs 64 bit pointers");
+
+    static constexpr uint64_t BOX_MASK     = 0xFFF8000000000000;
+    static constexpr uint64_t PAYLOAD_MASK = 0x0000FFFFFFFFFFFF;
+    static constexpr uint64_t CANONICAL_NAN = 0x7FF8000000000000;
+
+    static constexpr int TAG_SHIFT = 48;
+
+    static constexpr uint64_t OBJECT_TAG_BIT = 4;
+
+    enum Tag : uint64_t
+    {
+        TAG_NONE = 1, TAG_VARIABLE = 2, TAG_INT = 3,
+
+        TAG_STRING = OBJECT_TAG_BIT, TAG_ARRAY, TAG_NUMBERS, TAG_BIG_INT,
+    };
+
+    static constexpr int64_t SMALL_INT_MIN = -(1ll << 47);
+    static constexpr int64_t SMALL_INT_MAX = (1ll << 47) - 1;
+
+public:
+    Value() : bits(box(TAG_NONE, 0)) {}
+
+    Value(const Value& other) : bits(other.bits)
+    {
+        retain();
+    }
+
+    Value(Value&& other) noexcept : bits(other.bits)
+    {
+        other.bits = box(TAG_NONE, 0);
+    }
+
+    Value& operator=(const Value& other)
+    {
+        other.retain();
+        release();
+        bits = other.bits;
+        return *this;
+    }
+
+    Value& operator=(Value&& other) noexcept
+    {
+        if(this != &other)
+        {
+            release();
+            bits       = other.bits;
+            other.bits = box(TAG_NONE, 0);
+        }
+        return *this;
+    }
+
+    ~Value()
+    {
+        release();
+    }
+
+    Value(double number)
+    : bits(number != number ? CANONICAL_NAN : std::bit_cast<uint64_t>(number))
+    {}
+
+    Value(int64_t number);
+
+    template<std::integral T>
+    Value(T number) : Value((int64_t)number) {}
+
+    Value(std::string str);
+    Value(Array array);
+    Value(Numbers numbers);
+
+    Value(Token *var) : bits(box(TAG_VARIABLE, (uint64_t)var)) {}
+
+    // any double or integer
+    inline bool is_number() const
+    {
+        return is_double() || is_int();
+    }
+
+    inline bool is_double() const
+    {
+        return (bits & BOX_MASK) != BOX_MASK;
+    }
+
+    inline bool is_int() const
+    {
+        constexpr uint64_t mask = BOX_MASK | (3ull << TAG_SHIFT);
+        return (bits & mask) == box(TAG_INT, 0);
+    }
+
+    inline bool is_none()    const { return is(TAG_NONE); }
+    inline bool is_string()  const { return is(TAG_STRING); }
+    inline bool is_array()   const { return is(TAG_ARRAY); }
+    inline bool is_var()     const { return is(TAG_VARIABLE); }
+    inline bool is_numbers() const { return is(TAG_NUMBERS); }
+
+    ValueType type() const
+    {
+        if(is_double())
+            return ValueType::NUMBER;
+
+        switch(tag())
+        {
+            case TAG_INT:
+            case TAG_BIG_INT:  return ValueType::INTEGER;
+            case TAG_STRING:   return ValueType::STRING;
+            case TAG_ARRAY:    return ValueType::ARRAY;
+            case TAG_VARIABLE: return ValueType::VARIABLE;
+            case TAG_NUMBERS:  return ValueType::NUMBERS;
+            default:           return ValueType::NONE;
+        }
+    }
+
+    // integers are converted
+    inline double as_number() const
+    {
+        return is_double() ? std::bit_cast<double>(bits) : (double)as_int();
+    }
+
+    inline int64_t as_int() const;
+
+    // doubles are truncated
+    inline int64_t to_int() const
+    {
+        return is_int() ? as_int() : (int64_t)as_number();
+    }
+
+    inline const std::string& as_string() const;
+    inline const Array&       as_array()  const;
+    inline const Numbers&     as_numbers() const;
+
+    // copy on write access, the payload is copied first if anything else shares it
+    inline std::string& unique_string();
+    inline Array&       unique_array();
+    inline Numbers&     unique_numbers();
+
+    inline Token *as_var() const
+    {
+        return (Token*)payload();
+    }
+
+    inline uint64_t raw() const
+    {
+        return bits;
+    }
+
+    // what native code needs to handle integers that fit in the payload itself
+    static constexpr uint64_t SMALL_INT_BITS = BOX_MASK | ((uint64_t)TAG_INT << TAG_SHIFT);
+    static constexpr uint64_t PAYLOAD_BITS   = PAYLOAD_MASK;
+
+    // copies of these share a reference counted payload
+    inline bool is_object() const
+    {
+        constexpr uint64_t mask = BOX_MASK | (OBJECT_TAG_BIT << TAG_SHIFT);
+        return (bits & mask) == mask;
+    }
+
+private:
+    uint64_t bits;
+
+    static constexpr uint64_t box(uint64_t tag, uint64_t payload)
+    {
+        return BOX_MASK | (tag << TAG_SHIFT) | (payload & PAYLOAD_MASK);
+    }
+
+    inline void retain() const;
+    inline void release();
+
+    inline bool is(Tag t) const
+    {
+        return (bits & (BOX_MASK | (7ull << TAG_SHIFT))) == box(t, 0);
+    }
+
+    inline uint64_t tag() const
+    {
+        return (bits >> TAG_SHIFT) & 7;
+    }
+
+    inline void *payload() const
+    {
+        return (void*)(bits & PAYLOAD_MASK);
+    }
+};
+
+static_assert(sizeof(Value) == 8);
+
+struct Object
+{
+    virtual ~Object() = default;
+
+    uint32_t refs = 1;
+};
+
+struct IntObject : Object
+{
+    explicit IntObject(int64_t value) : value(value) {}
+
+    int64_t value;
+};
+
+struct StringObject : Object
+{
+    explicit StringObject(std::string data) : data(std::move(data)) {}
+
+    std::string data;
+};
+
+struct ArrayObject : Object
+{
+    explicit ArrayObject(Array data) : data(std::move(data)) {}
+
+    Array data;
+};
+
+// a dense array of doubles, what composite builds from numbers only
+struct NumbersObject : Object
+{
+    explicit NumbersObject(Numbers data) : data(std::move(data)) {}
+
+    Numbers data;
+};
+
+inline Value::Value(int64_t number)
+: bits(number >= SMALL_INT_MIN && number <= SMALL_INT_MAX
+       ? box(TAG_INT, (uint64_t)number)
+       : box(TAG_BIG_INT, (uint64_t)new IntObject(number)))
+{}
+
+inline Value::Value(std::string str)
+: bits(box(TAG_STRING, (uint64_t)new StringObject(std::move(str))))
+{}
+
+inline Value::Value(Array array)
+: bits(box(TAG_ARRAY, (uint64_t)new ArrayObject(std::move(array))))
+{}
+
+inline Value::Value(Numbers numbers)
+: bits(box(TAG_NUMBERS, (uint64_t)new NumbersObject(std::move(numbers))))
+{}
+
+inline void Value::retain() const
+{
+    if(!is_object())
+        return;
+
+    ((Object*)payload())->refs++;
+
+    if(!is(TAG_BIG_INT))
+        counters.copies++;
+}
+
+inline void Value::release()
+{
+    if(!is_object())
+        return;
+
+    Object *object = (Object*)payload();
+
+    if(--object->refs == 0)
+        delete object;
+}
+
+inline int64_t Value::as_int() const
+{
+    if(is(TAG_INT))
+        return (int64_t)(bits << 16) >> 16;
+
+    return ((IntObject*)payload())->value;
+}
+
+inline const std::string& Value::as_string() const
+{
+    return ((StringObject*)payload())->data;
+}
+
+inline const Array& Value::as_array() const
+{
+    return ((ArrayObject*)payload())->data;
+}
+
+inline const Numbers& Value::as_numbers() const
+{
+    return ((NumbersObject*)payload())->data;
+}
+
+inline std::string& Value::unique_string()
+{
+    if(((Object*)payload())->refs > 1)
+        *this = Value(as_string());
+
+    return ((StringObject*)payload())->data;
+}
+
+inline Array& Value::unique_array()
+{
+    if(((Object*)payload())->refs > 1)
+        *this = Value(as_array());
+
+    return ((ArrayObject*)payload())->data;
+}
+
+inline Numbers& Value::unique_numbers()
+{
+    if(((Object*)payload())->refs > 1)
+        *this = Value(as_numbers());
+
+    return ((NumbersObject*)payload())->data;
+}
@@ -2,41 +2,47 @@
 
 #include <map>
 #include <string>
-#include <variant>
 #include <cmath>
 #include <conio.h>
 
 #include "types.hpp"
 #include "stack.hpp"
+#include "simd.hpp"
+#include "perfect_hash.hpp"
+#include "output.hpp"
+#include "stats.hpp"
 
 typedef void(*builtin_fn)(Stack<Value>&);
 
-using Words = std::map<
-        std::string,
-        std::variant<
-                builtin_fn,
-                std::vector<Token>
-                >
-                >;
+// the bodies of user defined words, builtins live in builtin_table
+using Words = std::map<std::string, std::vector<Token>>;
 
 // for copy and pasting because im lazy
 // void (Stack<Value>& stack)
 
-void dup(Stack<Value>& stack)
+void duplicate(Stack<Value>& stack)
 {
     if(stack.empty())
         return;
     stack.push(stack.back());
 }
 
+// a b -- a b a
+void over(Stack<Value>& stack)
+{
+    if(stack.len() < 2)
+        return;
+    stack.push(stack.peek(1));
+}
+
 void nl(Stack<Value>& stack)
 {
-    std::cout << '\n';
+    output.put('\n');
 }
 
 void stack_len(Stack<Value>& stack)
 {
-    double len = stack.len();
+    size_t len = stack.len();
     stack.push(len);
 }
 
@@ -44,11 +50,10 @@ void emit(Stack<Value>& stack)
 {
     if(stack.empty())
         return;
-    if(stack.back().index() != 1)
+    if(!stack.back().is_number())
         return;
 
-    int value = std::get<double>(stack.back());
-    std::cout << (char)value;
+    output.put(stack.back().to_int());
 
     stack.pop();
 }
@@ -61,8 +66,8 @@ void program_exit(Stack<Value>& stack)
     {
         Value& top = stack.back();
 
-        if(top.index() != 0)
-            code = std::get<double>(top);
+        if(top.is_number())
+            code = top.to_int();
     }
 
     exit(code);
@@ -75,12 +80,24 @@ void mod(Stack<Value>& stack)
 
     auto [v_a, v_b] = stack.top_two();
 
-    if(v_a.index() != 1 || v_b.index() != 0)
+    if(!v_a.is_number() || !v_b.is_number())
         return;
 
+    // integers take the remainder directly, like fmod its sign follows a
+    if(v_a.is_int() && v_b.is_int() && v_b.as_int() != 0)
+    {
+        int64_t
+            a = v_a.as_int(),
+            b = v_b.as_int();
+
+        stack.pop_n(2);
+        stack.push(b == -1 ? 0 : a % b);
+        return;
+    }
+
     double
-        a = std::get<double>(v_a),
-        b = std::get<double>(v_b);
+        a = v_a.as_number(),
+        b = v_b.as_number();
 
     stack.pop_n(2);
     stack.push(std::fmod(a, b));
@@ -95,8 +112,31 @@ void drop(Stack<Value>& stack)
 
 void key(Stack<Value>& stack)
 {
-    double key = _getch();
-    stack.push(key);
+    // so a prompt shows up before waiting on the key
+    output.flush();
+    stack.push(_getch());
+}
+
+void flush(Stack<Value>& stack)
+{
+    output.flush();
+}
+
+// prints the counters --stats reports at exit, as they are so far
+void print_stats(Stack<Value>& stack)
+{
+    output.write(stats.report());
+}
+
+// prints a string without a newline or conversion, anything else is left alone
+void type(Stack<Value>& stack)
+{
+    if(stack.empty() || !stack.back().is_string())
+        return;
+
+    output.write(stack.back().as_string());
+
+    stack.pop();
 }
 
 void rotate(Stack<Value>& stack)
@@ -106,22 +146,19 @@ void rotate(Stack<Value>& stack)
 
     Value& v_amount = stack.back();
 
-    if(v_amount.index() != 1)
+    if(!v_amount.is_number())
         return;
 
-    const size_t amount = std::get<double>(v_amount);
+    const size_t amount = v_amount.as_number();
 
     if(amount > stack.len())
         return;
 
     stack.pop();
-
-    auto values = stack.get_vec_from_back(amount, true);
-
-    for(auto &val : values)
-        stack.push(val);
+    stack.reverse_top(amount);
 }
 
+// builds a dense number array when every item is numeric
 void composite(Stack<Value>& stack)
 {
     if(stack.empty())
@@ -129,30 +166,123 @@ void composite(Stack<Value>& stack)
 
     Value& v_amount = stack.back();
 
-    if(v_amount.index() != 1)
+    if(!v_amount.is_number())
         return;
 
-    size_t amount = std::get<double>(v_amount);
+    size_t amount = v_amount.as_number();
+
+    stack.pop();
+
+    if(amount > stack.len())
+        amount = stack.len();
+
+    bool numeric = true;
+
+    for(size_t i = 0; numeric && i < amount; i++)
+        numeric = stack.peek(i).is_number();
+
+    if(numeric)
+    {
+        Numbers output(amount);
+
+        for(size_t i = 0; i < amount; i++)
+            output[i] = stack.peek(i).as_number();
+
+        stack.pop_n(amount);
+        return stack.push(std::move(output));
+    }
 
     Array output;
 
     output.reserve(amount);
 
-    stack.pop();
+    for(size_t i = 0; i < amount; i++)
+        output.push_back(stack.peek(i));
 
-    for(size_t i = 0; !stack.empty() && i < amount; i++)
+    stack.pop_n(amount);
+    stack.push(std::move(output));
+}
+
+// ( a b -- c ) for two number arrays of the same length or an array and a number
+template<simd::Op op>
+void array_binary(Stack<Value>& stack)
+{
+    if(stack.len() < 2)
+        return;
+
+    auto [a, b] = stack.top_two();
+
+    const simd::Kernels& kernels = simd::kernels();
+
+    Numbers output;
+
+    if(a.is_numbers() && b.is_numbers())
     {
-        double val = std::get<double>(stack.back());
-        output.push_back(val);
-        stack.pop();
+        const Numbers &x = a.as_numbers(), &y = b.as_numbers();
+
+        if(x.size() != y.size())
+            return;
+
+        output.resize(x.size());
+        kernels.binary[op](x.data(), y.data(), output.data(), x.size());
     }
+    else if(a.is_numbers() && b.is_number())
+    {
+        const Numbers& x = a.as_numbers();
 
+        output.resize(x.size());
+        kernels.broadcast[op](x.data(), b.as_number(), output.data(), x.size());
+    }
+    else if(a.is_number() && b.is_numbers())
+    {
+        const Numbers& y = b.as_numbers();
+
+        output.resize(y.size());
+        kernels.broadcast_left[op](y.data(), a.as_number(), output.data(), y.size());
+    }
+    else
+        return;
+
+    stack.pop_n(2);
     stack.push(std::move(output));
 }
 
-static Words words =
+template<simd::reduce_kernel simd::Kernels::*kernel>
+void array_reduce(Stack<Value>& stack)
+{
+    if(stack.empty() || !stack.back().is_numbers())
+        return;
+
+    const Numbers& x = stack.back().as_numbers();
+
+    double output = (simd::kernels().*kernel)(x.data(), x.size());
+
+    stack.pop();
+    stack.push(output);
+}
+
+void array_dot(Stack<Value>& stack)
+{
+    if(stack.len() < 2)
+        return;
+
+    auto [a, b] = stack.top_two();
+
+    if(!a.is_numbers() || !b.is_numbers() || a.as_numbers().size() != b.as_numbers().size())
+        return;
+
+    double output = simd::kernels().dot(a.as_numbers().data(), b.as_numbers().data(), a.as_numbers().size());
+
+    stack.pop_n(2);
+    stack.push(output);
+}
+
+static Words words;
+
+static constexpr auto builtin_table = perfect_hash::make<builtin_fn>(
 {
-        {"dup",       dup},
+        {"dup",       duplicate},
+        {"over",      over},
         {"nl",        nl},
         {"emit",      emit},
         {"stack-len", stack_len},
@@ -160,6 +290,20 @@ static Words words =
         {"mod",       mod},
         {"drop",      drop},
         {"key",       key},
+        {"flush",     flush},
+        {"type",      type},
+        {"stats",     print_stats},
         {"rotate",    rotate},
-        {"composite", composite}
-};
\ No newline at end of file
+        {"composite", composite},
+        {"array+",    array_binary<simd::ADD>},
+        {"array-",    array_binary<simd::SUB>},
+        {"array*",    array_binary<simd::MUL>},
+        {"array/",    array_binary<simd::DIV>},
+        {"array<",    array_binary<simd::LESS>},
+        {"array>",    array_binary<simd::GREATER>},
+        {"array=",    array_binary<simd::EQUAL>},
+        {"array-sum", array_reduce<&simd::Kernels::sum>},
+        {"array-min", array_reduce<&simd::Kernels::min>},
+        {"array-max", array_reduce<&simd::Kernels::max>},
+        {"array-dot", array_dot},
+});
\ No newline at end of file